@@ -6,9 +6,12 @@
 #include <lua.h>
 #include <subhook.h>
 
-#include <fstream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <dlfcn.h>
 #include <sys/stat.h>
@@ -19,6 +22,11 @@
 #include <dsl/Package.hh>
 #include <dsl/Transport.hh>
 
+#include <dbutil/AccessTrace.h>
+#include <dbutil/AssetCache.h>
+#include <dbutil/CompressedFile.h>
+#include <dbutil/DB.h>
+#include <dbutil/IoStats.h>
 #include <scriptdata/FontData.h>
 #include <scriptdata/ScriptData.h>
 #include <tweaker/db_hooks.h>
@@ -154,25 +162,69 @@ namespace blt
 		}; // namespace assets
 	}; // namespace lapi
 
-	// A datastore that simply provides the contents of a string
-	class StringDataStore : public CustomDataStore
+	// A custom asset after it's been recoded, kept so loading it again doesn't have to recode it again. The most
+	// recently used of these are kept, up to a fixed total size.
+	struct recoded_asset_t
 	{
-	  public:
-		virtual ~StringDataStore() override;
-		virtual size_t write(size_t position_in_file, uint8_t const* data, size_t length) override;
-		virtual size_t read(size_t position_in_file, uint8_t* data, size_t length) override;
-		virtual bool close() override;
-		virtual size_t size() const override;
-		virtual bool is_asynchronous() const override;
-		// virtual void set_asynchronous_completion_callback(void* /*dsl::LuaRef*/) {} // ignore this
-		// virtual uint64_t state() { return 0; } // ignore this
-		virtual bool good() const override;
-
-		std::string contents;
-		StringDataStore(std::string contents) : contents(contents)
+		std::string filename;
+		time_t mtime;
+		off_t size;
+		blt::db::AssetBuffer contents;
+	};
+
+	static const size_t RECODED_ASSETS_CAPACITY = 32 * 1024 * 1024;
+
+	static std::mutex recoded_assets_mutex;
+	static std::list<recoded_asset_t> recoded_assets; // Most recently used first
+	static std::map<std::string, std::list<recoded_asset_t>::iterator> recoded_assets_index;
+	static size_t recoded_assets_size = 0;
+
+	// Find the recoded version of a custom asset, if it's been recoded since it last changed
+	static blt::db::AssetBuffer find_recoded_asset(const string& filename, const struct stat& info)
+	{
+		std::lock_guard guard(recoded_assets_mutex);
+
+		auto iter = recoded_assets_index.find(filename);
+		if (iter == recoded_assets_index.end())
+			return nullptr;
+
+		const recoded_asset_t& asset = *iter->second;
+		if (asset.mtime != info.st_mtime || asset.size != info.st_size)
+			return nullptr;
+
+		recoded_assets.splice(recoded_assets.begin(), recoded_assets, iter->second);
+		return asset.contents;
+	}
+
+	static void add_recoded_asset(const string& filename, const struct stat& info, blt::db::AssetBuffer contents)
+	{
+		std::lock_guard guard(recoded_assets_mutex);
+
+		// Replace the old version, if the file has changed
+		auto iter = recoded_assets_index.find(filename);
+		if (iter != recoded_assets_index.end())
 		{
+			recoded_assets_size -= iter->second->contents->size();
+			recoded_assets.erase(iter->second);
+			recoded_assets_index.erase(iter);
 		}
-	};
+
+		// Don't let one huge asset push everything else out
+		if (contents->size() > RECODED_ASSETS_CAPACITY / 4)
+			return;
+
+		recoded_assets_size += contents->size();
+		recoded_assets.push_front(recoded_asset_t{filename, info.st_mtime, info.st_size, std::move(contents)});
+		recoded_assets_index[filename] = recoded_assets.begin();
+
+		while (recoded_assets_size > RECODED_ASSETS_CAPACITY)
+		{
+			const recoded_asset_t& last = recoded_assets.back();
+			recoded_assets_size -= last.contents->size();
+			recoded_assets_index.erase(last.filename);
+			recoded_assets.pop_back();
+		}
+	}
 
 	// The acual function hooks
 
@@ -229,52 +281,92 @@ namespace blt
 		// recode them
 		if (type != asset_t::PLAIN)
 		{
-			// Create a datastore. This is what you might call a backing object, which the archive will refer to.
-			// Note that the archive will delete the datastore when it's done, so this isn't a memory leak.
-			auto* datastore = new StringDataStore("");
+			blt::db::AssetBuffer recoded = find_recoded_asset(filename, buffer);
 
-			// Read the file in question
-			std::ifstream in(filename, std::ios::in | std::ios::binary);
-			if (!in)
+			if (!recoded)
 			{
-				// TODO error message
-				abort();
+				// Read the file in question, decompressing it if it was shipped compressed
+				std::unique_ptr<BLTAbstractDataStore> in(blt::db::DieselDB::OpenFile(filename));
+				if (!in)
+				{
+					// TODO error message
+					abort();
+				}
+
+				std::string contents;
+				contents.resize(in->size());
+				if (in->read(0, (uint8_t*)&contents[0], contents.size()) != contents.size())
+				{
+					string err = "Failed to read registered asset " + filename;
+					log::log(err, log::LOG_ERROR);
+					throw err;
+				}
+				in.reset();
+
+				switch (type)
+				{
+				case asset_t::SCRIPTDATA:
+				{
+					pd2hook::scriptdata::ScriptData sd(contents.size(), (const uint8_t*)contents.c_str());
+					contents = sd.GetRoot()->Serialise(false);
+					break;
+				}
+				case asset_t::FONT:
+				{
+					pd2hook::scriptdata::font::FontData fd(contents);
+					contents = fd.Export(false);
+					break;
+				}
+				default:
+					string msg = "Unknown asset typecode " + to_string(type) +
+					             " - this is probably a bug in SuperBLT, please report it";
+					throw msg;
+				}
+
+				recoded = std::make_shared<const std::vector<uint8_t>>(contents.begin(), contents.end());
+				add_recoded_asset(filename, buffer, recoded);
 			}
 
-			std::string& contents = datastore->contents;
-			in.seekg(0, std::ios::end);
-			contents.resize(in.tellg());
-			in.seekg(0, std::ios::beg);
-			in.read(&contents[0], contents.size());
-			in.close();
+			// Create a datastore. This is what you might call a backing object, which the archive will refer to.
+			// Note that the archive will delete the datastore when it's done, so this isn't a memory leak. It
+			// shares the recoded contents with the cache, and any other archives still reading them.
+			BLTAbstractDataStore* datastore = new BLTSharedBufferDataStore(recoded);
+			datastore = blt::db::IoStats::Instance().Wrap(datastore, blt::db::IoSource::String);
 
-			switch (type)
-			{
-			case asset_t::SCRIPTDATA:
+			// Create an archive using our datastore, in the memory location passed in (this is how
+			// an object is returned in C++ - memory is allocated by the caller, and the pointer is passed
+			// in the first argument, even before "this").
+			archive_ctor(target, cxxstr, (CustomDataStore*)datastore, 0, datastore->size(), false, nullptr);
+			return;
+		}
+
+		// Open the file ourselves, so compressed files can be decompressed as the game reads them. The handle used
+		// to check for compression is the one the datastore reads from, so the file is only opened once.
+		std::shared_ptr<BLTSharedFile> file = BLTSharedFile::Open(filename);
+		if (file)
+		{
+			BLTAbstractDataStore* datastore;
+			if (BLTCompressedDataStore::IsCompressed(*file))
 			{
-				pd2hook::scriptdata::ScriptData sd(contents.size(), (const uint8_t*)contents.c_str());
-				contents = sd.GetRoot()->Serialise(false);
-				break;
+				datastore = BLTCompressedDataStore::Open(std::move(file), filename);
+				if (!datastore)
+				{
+					string err = "Cannot open compressed asset " + filename;
+					log::log(err, log::LOG_ERROR);
+					throw err;
+				}
 			}
-			case asset_t::FONT:
+			else
 			{
-				pd2hook::scriptdata::font::FontData fd(contents);
-				contents = fd.Export(false);
-				break;
-			}
-			default:
-				string msg = "Unknown asset typecode " + to_string(type) +
-				             " - this is probably a bug in SuperBLT, please report it";
-				throw msg;
+				datastore = new BLTSharedFileDataStore(std::move(file));
 			}
+			datastore = blt::db::IoStats::Instance().Wrap(datastore, blt::db::IoSource::PlainFile);
 
-			// Create an archive using our datastore, in the memory location passed in (this is how
-			// an object is returned in C++ - memory is allocated by the caller, and the pointer is passed
-			// in the first argument, even before "this").
-			archive_ctor(target, cxxstr, datastore, 0, datastore->size(), false, nullptr);
+			archive_ctor(target, cxxstr, (CustomDataStore*)datastore, 0, datastore->size(), false, nullptr);
 			return;
 		}
 
+		// Let the game report the file being unreadable in it's usual way
 		dsl_fss_open(target, &db->stack, &cxxstr);
 	}
 
@@ -301,6 +393,9 @@ namespace blt
 
 		hash_t hash(name->value, ext->value);
 
+		// Remember this asset was used, so it can be prefetched next time
+		blt::db::AccessTrace::Instance().Record(name->value, ext->value);
+
 		// First let Wren override the files
 		if (try_hook_load(target, hash, false))
 			return target;
@@ -468,51 +563,6 @@ namespace blt
 		lua_setfield(L, -2, "db_create_entry");
 		lua_pop(L, 1);
 	}
-
-	// StringDataStore implementation
-	StringDataStore::~StringDataStore()
-	{
-	}
-
-	size_t StringDataStore::write(size_t position_in_file, uint8_t const* data, size_t length)
-	{
-		// simply not supported, TODO handle this better?
-		abort();
-	}
-
-	size_t StringDataStore::read(size_t position_in_file, uint8_t* data, size_t length)
-	{
-		size_t real_len = min(length, size() - position_in_file);
-
-		if (real_len <= 0)
-			return 0;
-
-		std::copy(contents.begin() + position_in_file, contents.begin() + real_len, data);
-		return real_len;
-	}
-
-	bool StringDataStore::close()
-	{
-		// TODO clear out the string and make good() return false
-
-		// afaik we just should always return true?
-		return true;
-	}
-
-	size_t StringDataStore::size() const
-	{
-		return contents.length();
-	}
-
-	bool StringDataStore::is_asynchronous() const
-	{
-		return false;
-	}
-
-	bool StringDataStore::good() const
-	{
-		return true;
-	}
 }; // namespace blt
 
 /* vim: set ts=4 sw=4 noexpandtab: */
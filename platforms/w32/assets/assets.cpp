@@ -12,6 +12,7 @@
 #include <stdio.h>
 
 #include <string>
+#include <dbutil/AccessTrace.h>
 #include <tweaker/db_hooks.h>
 #include <utility>
 
@@ -65,6 +66,9 @@ DECLARE_PASSTHROUGH_ARRAY(3)
 static void hook_load(try_open_t orig, subhook::Hook& hook, void* this_, void* archive,
                       blt::idstring type, blt::idstring name, int u1, int u2)
 {
+	// Remember this asset was used, so it can be prefetched next time
+	blt::db::AccessTrace::Instance().Record(name, type);
+
 	// Try hooking this asset, and see if we need to handle it differently
 	BLTAbstractDataStore* datastore = nullptr;
 	int64_t pos = 0, len = 0;
@@ -18,7 +18,10 @@
 #include "luautil/luautil.h"
 #include "luautil/LuaAssetDb.h"
 #include "luautil/LuaAsyncIO.h"
+#include "luautil/LuaPerf.h"
+#include "dbutil/AccessTrace.h"
 #include "dbutil/DB.h"
+#include "dbutil/IoStats.h"
 
 #include <thread>
 #include <list>
@@ -376,7 +379,7 @@ namespace pd2hook
 			lua_settable(ourData->L, -3);
 		}
 		lua_settable(ourData->L, -3);
-		handled_pcall(ourData->L, 3, 0);
+		pd2hook::handled_pcall(ourData->L, 3, 0);
 		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->funcRef);
 		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->progressRef);
 		delete ourData;
@@ -409,7 +412,7 @@ namespace pd2hook
 		lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
 		lua_pushlstring(L, result.c_str(), result.size());
 		lua_pushlstring(L, filename.c_str(), filename.size());
-		handled_pcall(L, 2, 0);
+		pd2hook::handled_pcall(L, 2, 0);
 
 		luaL_unref(L, LUA_REGISTRYINDEX, ref);
 	}
@@ -892,6 +895,7 @@ namespace blt
 		void initiate_lua(lua_State *L)
 		{
 			add_active_state(L);
+			blt::db::AccessTrace::Instance().StartState();
 
 			if (!setup_check_done)
 			{
@@ -982,6 +986,7 @@ namespace blt
 			load_lua_utils(L);
 			load_lua_asset_db(L);
 			load_lua_async_io(L);
+			load_lua_perf(L);
 			pd2hook::tweaker::lua_io::register_lua_functions(L);
 
 			lua_pop(L, 1); // pop the BLT library
@@ -1029,6 +1034,8 @@ namespace blt
 		void close(lua_State *L)
 		{
 			remove_active_state(L);
+			blt::db::AccessTrace::Instance().Save();
+			blt::db::IoStats::Instance().Log();
 		}
 
 		void update(lua_State *L)
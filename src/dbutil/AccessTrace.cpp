@@ -0,0 +1,351 @@
+#include "AccessTrace.h"
+#include "Prefetch.h"
+
+#include <util/util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace blt::db;
+using blt::idstring;
+
+static const char* TRACE_PATH = "mods/saves/sblt_asset_trace.bin";
+
+// Bump this whenever the layout of the trace file changes
+static const uint32_t TRACE_VERSION = 2;
+static const char TRACE_MAGIC[8] = {'S', 'B', 'L', 'T', 'T', 'R', 'C', 0};
+
+// Keep at most this many assets in the trace - at 40 bytes each, that's a few megabytes
+static const size_t MAX_ENTRIES = 65536;
+
+// Drop assets which haven't been used for this many sessions
+static const uint16_t MAX_AGE = 5;
+
+// Only prefetch this much when replaying the trace. On Windows prefetching actually reads the data, so this
+// shouldn't be much more than what a level load would read anyway.
+static const uint64_t MAX_REPLAY_BYTES = 256 * 1024 * 1024;
+
+namespace
+{
+	struct TraceHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t stringsSize;
+		uint32_t padding;
+		uint64_t fingerprint; // See DieselDB::CurrentFingerprint
+	};
+
+	struct TraceEntry
+	{
+		idstring name;
+		idstring ext;
+		uint32_t bundle; // Offset of the bundle's path in the string table
+		uint32_t offset;
+		uint32_t length;
+		uint32_t firstTouchMs;
+		uint16_t age;
+		uint16_t bundleLength;
+		uint32_t padding;
+	};
+
+	static_assert(sizeof(TraceHeader) == 32);
+	static_assert(sizeof(TraceEntry) == 40);
+
+	uint64_t monotonicTimeMicros()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+	}
+} // namespace
+
+AccessTrace& AccessTrace::Instance()
+{
+	static AccessTrace instance;
+	return instance;
+}
+
+void AccessTrace::StartState()
+{
+	std::lock_guard guard(mutex);
+	stateStartMicros = monotonicTimeMicros();
+}
+
+void AccessTrace::SetEnabled(bool enable)
+{
+	enabled = enable;
+	if (enable)
+		Replay();
+}
+
+void AccessTrace::Replay()
+{
+	{
+		std::lock_guard guard(mutex);
+		if (replayed)
+			return;
+		replayed = true;
+	}
+
+	// Don't hold the lock while reading the trace, since everything recording assets would have to wait
+	uint64_t fingerprint = 0;
+	std::vector<Entry> loaded = Load(&fingerprint);
+	if (loaded.empty())
+		return;
+
+	{
+		std::lock_guard guard(mutex);
+		previous = loaded;
+	}
+
+	// If the bundles have changed, the assets have probably moved and there's no point reading the old
+	// locations. Save finds them again, so the trace is still useful next time.
+	if (fingerprint != DieselDB::CurrentFingerprint())
+	{
+		PD2HOOK_LOG_LOG("Not prefetching the asset trace, since the game's bundles have changed");
+		return;
+	}
+
+	// Prefetch the assets that were needed first, up to the replay budget. Prefetch then sorts the ranges by their
+	// file and offset, so they're read in the friendliest order possible.
+	std::stable_sort(loaded.begin(), loaded.end(),
+	                 [](const Entry& a, const Entry& b) { return a.firstTouchMs < b.firstTouchMs; });
+
+	std::vector<PrefetchRange> ranges;
+	uint64_t bytes = 0;
+	for (const Entry& entry : loaded)
+	{
+		// End-of-file assets don't have a known size, so they can't be counted against the budget
+		if (entry.length == 0)
+			continue;
+
+		if (bytes + entry.length > MAX_REPLAY_BYTES)
+			break;
+		bytes += entry.length;
+
+		ranges.push_back(PrefetchRange{entry.bundle, entry.offset, entry.length});
+	}
+
+	if (!ranges.empty())
+	{
+		PD2HOOK_LOG_LOG("Prefetching " + std::to_string(ranges.size()) + " assets (" + std::to_string(bytes >> 20) +
+		                " MiB) used in previous sessions");
+		Prefetch(std::move(ranges));
+	}
+}
+
+void AccessTrace::Record(idstring name, idstring ext)
+{
+	if (!enabled.load(std::memory_order_relaxed) || full.load(std::memory_order_relaxed))
+		return;
+
+	std::lock_guard guard(mutex);
+
+	if (accesses.size() >= MAX_ENTRIES)
+	{
+		full = true;
+		return;
+	}
+
+	if (!seen.insert(std::make_pair(name, ext)).second)
+		return;
+
+	uint32_t time = (uint32_t)((monotonicTimeMicros() - stateStartMicros) / 1000);
+	accesses.push_back(Access{name, ext, time});
+}
+
+void AccessTrace::Save()
+{
+	if (!enabled)
+		return;
+
+	std::vector<Access> current;
+	std::vector<Entry> entries;
+	{
+		std::lock_guard guard(mutex);
+		current = accesses;
+		entries = previous;
+	}
+
+	if (current.empty())
+		return;
+
+	// Don't load the DB just for this. The accesses are kept, so they'll be saved when the next state closes
+	// if anything has loaded it by then.
+	std::shared_ptr<DieselDB> db = DieselDB::InstanceIfLoaded();
+	if (!db)
+		return;
+
+	// Find where an asset is in the bundles. Those that aren't in the bundles (eg, custom assets) can't be
+	// prefetched, so they're not kept.
+	auto locate = [&db](Entry& entry) {
+		std::optional<DslFile> file = db->Find(entry.name, entry.ext);
+		if (!file || !file->Found())
+			return false;
+
+		entry.bundle = file->bundle->path;
+		entry.offset = file->offset;
+		entry.length = file->HasLength() ? file->length : 0;
+		return true;
+	};
+
+	// The previous sessions' assets may have moved if the bundles have changed since, so look them all up again
+	size_t kept = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (!locate(entries[i]))
+			continue;
+		if (kept != i)
+			entries[kept] = std::move(entries[i]);
+		kept++;
+	}
+	entries.resize(kept);
+
+	// Assets used this session replace their previous entries. Everything else gets older.
+	std::map<std::pair<idstring, idstring>, size_t> index;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entries[i].age++;
+		index[std::make_pair(entries[i].name, entries[i].ext)] = i;
+	}
+
+	for (const Access& access : current)
+	{
+		Entry entry{access.name, access.ext, "", 0, 0, access.firstTouchMs, 0};
+		if (!locate(entry))
+			continue;
+
+		auto iter = index.find(std::make_pair(access.name, access.ext));
+		if (iter != index.end())
+		{
+			entries[iter->second] = entry;
+		}
+		else
+		{
+			index[std::make_pair(access.name, access.ext)] = entries.size();
+			entries.push_back(entry);
+		}
+	}
+
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& e) { return e.age > MAX_AGE; }),
+	              entries.end());
+
+	// If there's too many, keep the most recently used, and then those that were needed earliest
+	if (entries.size() > MAX_ENTRIES)
+	{
+		std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+			if (a.age != b.age)
+				return a.age < b.age;
+			return a.firstTouchMs < b.firstTouchMs;
+		});
+		entries.resize(MAX_ENTRIES);
+	}
+
+	// Build the file contents
+	std::string strings;
+	std::map<std::string, uint32_t> bundleOffsets;
+	std::vector<TraceEntry> table;
+	for (const Entry& entry : entries)
+	{
+		auto iter = bundleOffsets.find(entry.bundle);
+		if (iter == bundleOffsets.end())
+		{
+			iter = bundleOffsets.emplace(entry.bundle, (uint32_t)strings.size()).first;
+			strings += entry.bundle;
+		}
+
+		TraceEntry te = {};
+		te.name = entry.name;
+		te.ext = entry.ext;
+		te.bundle = iter->second;
+		te.bundleLength = (uint16_t)entry.bundle.size();
+		te.offset = entry.offset;
+		te.length = entry.length;
+		te.firstTouchMs = entry.firstTouchMs;
+		te.age = entry.age;
+		table.push_back(te);
+	}
+
+	TraceHeader header = {};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.entryCount = (uint32_t)table.size();
+	header.stringsSize = (uint32_t)strings.size();
+	header.fingerprint = db->GetFingerprint();
+
+	// Write to a temporary file and move it into place, so a crash half-way through can't leave a broken trace
+	std::string tmpPath = std::string(TRACE_PATH) + ".tmp";
+	pd2hook::Util::EnsurePathWritable(tmpPath);
+
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)table.data(), table.size() * sizeof(TraceEntry));
+		out.write(strings.data(), strings.size());
+
+		if (!out.good())
+		{
+			PD2HOOK_LOG_WARN("Failed to write asset trace to " + tmpPath);
+			out.close();
+			remove(tmpPath.c_str());
+			return;
+		}
+	}
+
+	// On Windows rename won't replace an existing file
+	remove(TRACE_PATH);
+	if (rename(tmpPath.c_str(), TRACE_PATH) != 0)
+	{
+		PD2HOOK_LOG_WARN(std::string("Failed to move asset trace into place at ") + TRACE_PATH);
+		remove(tmpPath.c_str());
+	}
+}
+
+std::vector<AccessTrace::Entry> AccessTrace::Load(uint64_t* fingerprint)
+{
+	std::ifstream in(TRACE_PATH, std::ios::binary);
+	if (!in.good())
+		return {};
+
+	TraceHeader header = {};
+	in.read((char*)&header, sizeof(header));
+	if (!in.good() || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != TRACE_VERSION || header.entryCount > MAX_ENTRIES)
+	{
+		PD2HOOK_LOG_LOG("Ignoring asset trace from an incompatible version of SuperBLT");
+		return {};
+	}
+
+	std::vector<TraceEntry> table(header.entryCount);
+	std::string strings(header.stringsSize, '\0');
+	in.read((char*)table.data(), table.size() * sizeof(TraceEntry));
+	in.read(strings.data(), strings.size());
+	if (!in.good())
+	{
+		PD2HOOK_LOG_WARN("Asset trace is truncated, ignoring it");
+		return {};
+	}
+
+	*fingerprint = header.fingerprint;
+
+	std::vector<Entry> entries;
+	for (const TraceEntry& te : table)
+	{
+		if ((uint64_t)te.bundle + te.bundleLength > strings.size())
+		{
+			PD2HOOK_LOG_WARN("Asset trace is corrupt, ignoring it");
+			return {};
+		}
+
+		entries.push_back(Entry{te.name, te.ext, strings.substr(te.bundle, te.bundleLength), te.offset, te.length,
+		                        te.firstTouchMs, te.age});
+	}
+
+	return entries;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "DB.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * Records which assets the game opens, so the next time it starts they can be read into the page cache in
+	 * the background before the game asks for them. This mostly helps level loads on a cold cache.
+	 *
+	 * This is off unless it's turned on with SetEnabled (blt.asset_db.set_trace_enabled), since it costs a
+	 * little on every asset the game opens.
+	 *
+	 * Each asset is only recorded the first time it's opened. The trace is saved whenever a Lua state is
+	 * closed, merged with the trace from previous sessions: assets that weren't used this session age by one,
+	 * and are dropped once they haven't been used for several sessions in a row.
+	 */
+	class AccessTrace
+	{
+	  public:
+		static AccessTrace& Instance();
+
+		/** Called when a new Lua state is created. Access times are recorded relative to this. */
+		void StartState();
+
+		/**
+		 * Turn recording on or off. The first time it's turned on, the trace from the previous session is
+		 * replayed, unless the game's bundles have changed since it was saved.
+		 */
+		void SetEnabled(bool enable);
+
+		/**
+		 * Record an asset being opened by the game. This is safe to call from any thread, and doesn't lock
+		 * anything if recording is off or the trace is already full.
+		 */
+		void Record(idstring name, idstring ext);
+
+		/**
+		 * Write out the trace, including the assets from previous sessions that haven't aged out yet. This does
+		 * nothing if the DB hasn't been loaded, since it's needed to find where the assets are.
+		 */
+		void Save();
+
+	  private:
+		AccessTrace() = default;
+
+		struct Entry
+		{
+			idstring name;
+			idstring ext;
+			std::string bundle;
+			uint32_t offset;
+			uint32_t length;        // May be zero for end-of-file assets, which continue to the end of the bundle
+			uint32_t firstTouchMs;  // Time since the Lua state was created
+			uint16_t age;           // Number of sessions since this asset was last used
+		};
+
+		struct Access
+		{
+			idstring name;
+			idstring ext;
+			uint32_t firstTouchMs;
+		};
+
+		// Load the previous session's trace, or nothing if there isn't a valid one. The fingerprint of the bundles
+		// it was saved against is stored in fingerprint.
+		static std::vector<Entry> Load(uint64_t* fingerprint);
+
+		// Prefetch the assets from the previous session's trace, see SetEnabled
+		void Replay();
+
+		std::atomic<bool> enabled = false;
+		std::atomic<bool> full = false;
+
+		std::mutex mutex;
+		bool replayed = false;
+		uint64_t stateStartMicros = 0;
+
+		std::vector<Entry> previous;
+		std::vector<Access> accesses;
+		std::set<std::pair<idstring, idstring>> seen;
+	};
+
+}; // namespace blt::db
@@ -0,0 +1,98 @@
+#include "AssetCache.h"
+
+#include <fstream>
+
+using namespace blt::db;
+
+// Don't cache anything bigger than this fraction of the cache's capacity
+static const size_t MAX_ENTRY_FRACTION = 4;
+
+AssetCache& AssetCache::Instance()
+{
+	static AssetCache instance;
+	return instance;
+}
+
+AssetBuffer AssetCache::Get(const DslFile& file)
+{
+	// Files are identified by their ID, which is unique within a single version of the DB
+	uint64_t key = ((uint64_t)(uint32_t)file.fileId << 32) | (uint32_t)file.generation;
+
+	{
+		std::lock_guard guard(mutex);
+
+		auto iter = index.find(key);
+		if (iter != index.end())
+		{
+			// Move it to the front, since it's now the most recently used
+			entries.splice(entries.begin(), entries, iter->second);
+			hits++;
+			return iter->second->second;
+		}
+
+		misses++;
+	}
+
+	// Read the file without holding the lock, so other threads can still use the cache. If two threads miss
+	// on the same file at once it'll be read twice, but that's harmless.
+	// Binary mode is important, otherwise the read fails on Windows with failbit set and errno untouched
+	std::ifstream in;
+	in.exceptions(std::ios::failbit);
+	in.open(file.bundle->path, std::ios::binary);
+	AssetBuffer buffer = std::make_shared<const std::vector<uint8_t>>(file.ReadContents(in));
+
+	if (!IsCacheable(buffer->size()))
+		return buffer;
+
+	std::lock_guard guard(mutex);
+
+	// Another thread might have added it while we were reading it, or the DB might have been reloaded
+	if (index.count(key) || file.generation < generation)
+		return buffer;
+	generation = file.generation;
+
+	entries.emplace_front(key, buffer);
+	index[key] = entries.begin();
+	size += buffer->size();
+	Trim();
+
+	return buffer;
+}
+
+bool AssetCache::IsCacheable(size_t length) const
+{
+	std::lock_guard guard(mutex);
+	return length <= capacity / MAX_ENTRY_FRACTION;
+}
+
+void AssetCache::SetCapacity(size_t bytes)
+{
+	std::lock_guard guard(mutex);
+	capacity = bytes;
+	Trim();
+}
+
+AssetCache::Stats AssetCache::GetStats() const
+{
+	std::lock_guard guard(mutex);
+	return Stats{hits, misses, size, entries.size(), capacity};
+}
+
+void AssetCache::Clear()
+{
+	std::lock_guard guard(mutex);
+	entries.clear();
+	index.clear();
+	size = 0;
+}
+
+void AssetCache::Trim()
+{
+	while (size > capacity && !entries.empty())
+	{
+		Entry& last = entries.back();
+		size -= last.second->size();
+		index.erase(last.first);
+		entries.pop_back();
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "DB.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * The contents of an asset. These are immutable and reference counted, so the same buffer can be handed
+	 * out to several consumers (and kept in the cache) without copying it.
+	 */
+	using AssetBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+	/**
+	 * A process-wide cache of the raw contents of assets read from the bundles.
+	 *
+	 * Mods tend to read the same base-game assets over and over, through Lua, Wren and asset hooks. This keeps
+	 * the most recently used of them in memory, up to a fixed total size, so those reads don't have to go back
+	 * to the disk each time. It's safe to use from any thread.
+	 */
+	class AssetCache
+	{
+	  public:
+		// 64MiB, which comfortably fits the sort of text-based assets mods usually read
+		static const size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+		struct Stats
+		{
+			uint64_t hits;
+			uint64_t misses;
+			size_t size;  // Total size of the cached assets, in bytes
+			size_t count; // Number of cached assets
+			size_t capacity;
+		};
+
+		static AssetCache& Instance();
+
+		/**
+		 * Get the contents of an asset, reading them from it's bundle if they're not already cached. Throws
+		 * std::ios::failure if the bundle can't be read.
+		 */
+		AssetBuffer Get(const DslFile& file);
+
+		/**
+		 * Check if an asset of the given size would be stored in the cache. Assets which take up a large part
+		 * of the cache aren't stored, as they'd push everything else out of it.
+		 */
+		[[nodiscard]] bool IsCacheable(size_t length) const;
+
+		/** Set the maximum total size of the cached assets, in bytes. Zero disables the cache. */
+		void SetCapacity(size_t bytes);
+
+		[[nodiscard]] Stats GetStats() const;
+
+		/** Drop everything from the cache. Any buffers that are still in use elsewhere remain valid. */
+		void Clear();
+
+	  private:
+		AssetCache() = default;
+
+		// Remove the least recently used entries until the cache fits in it's capacity. Must hold the mutex.
+		void Trim();
+
+		// Entries are keyed on the file's ID in the upper bits and the DB's generation in the lower bits, since
+		// the IDs are reused for different files when the DB is reloaded
+		using Entry = std::pair<uint64_t, AssetBuffer>;
+
+		mutable std::mutex mutex;
+		std::list<Entry> entries; // Most recently used first
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+		// The newest DB generation a file has been read from. Files from older generations aren't added, so a
+		// read that was in progress while the DB was reloaded can't fill the cache back up with stale assets.
+		uint64_t generation = 0;
+
+		size_t size = 0;
+		size_t capacity = DEFAULT_CAPACITY;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+	};
+
+}; // namespace blt::db
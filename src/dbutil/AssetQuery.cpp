@@ -0,0 +1,104 @@
+#include "AssetQuery.h"
+
+#include <tuple>
+
+using namespace blt::db;
+
+AssetQuery::AssetQuery(std::shared_ptr<DieselDB> database, const Filter& filter)
+    : db(std::move(database)), filter(filter)
+{
+	// With both a name and type there's at most one asset, in however many languages, so just walk through them
+	if (filter.name && filter.type)
+	{
+		mode = Mode::LANGUAGES;
+		std::optional<DslFile> head = db->Find(*filter.name, *filter.type);
+		pos = head ? (uint32_t)(head->fileId - 1) : DslFile::NONE;
+
+		// The list can't be longer than the number of files, so stop there in case a corrupt snapshot has a
+		// loop in it
+		end = (uint32_t)db->FileCount();
+		return;
+	}
+
+	std::optional<std::pair<uint32_t, uint32_t>> typeRange;
+	std::optional<std::pair<uint32_t, uint32_t>> bundleRange;
+	if (filter.type)
+		typeRange = db->FileRangeByType(*filter.type);
+	if (filter.bundle)
+		bundleRange = db->FileRangeByBundle(*filter.bundle);
+
+	// If we can use either view, pick whichever has fewer files to check
+	auto rangeSize = [](const std::pair<uint32_t, uint32_t>& range) { return range.second - range.first; };
+	if (typeRange && bundleRange && rangeSize(*bundleRange) < rangeSize(*typeRange))
+		typeRange = std::nullopt;
+
+	if (typeRange)
+	{
+		mode = Mode::BY_TYPE;
+		view = db->FilesByType().data();
+		std::tie(pos, end) = *typeRange;
+	}
+	else if (bundleRange)
+	{
+		mode = Mode::BY_BUNDLE;
+		view = db->FilesByBundle().data();
+		std::tie(pos, end) = *bundleRange;
+	}
+	else
+	{
+		mode = Mode::ALL;
+		pos = 0;
+		end = (uint32_t)db->FileCount();
+	}
+}
+
+bool AssetQuery::Done() const
+{
+	if (mode == Mode::LANGUAGES)
+		return pos >= db->FileCount() || end == 0;
+
+	return pos >= end;
+}
+
+std::optional<DslFile> AssetQuery::Next()
+{
+	const DslFileTable& table = db->Files();
+
+	if (mode == Mode::LANGUAGES)
+	{
+		while (pos < table.Size() && end > 0)
+		{
+			uint32_t index = pos;
+			pos = table.next[index];
+			end--;
+			if (Matches(index))
+				return db->GetFile(index);
+		}
+		return std::nullopt;
+	}
+
+	while (pos < end)
+	{
+		uint32_t index = view ? view[pos] : pos;
+		pos++;
+		if (Matches(index))
+			return db->GetFile(index);
+	}
+	return std::nullopt;
+}
+
+bool AssetQuery::Matches(uint32_t index) const
+{
+	const DslFileTable& table = db->Files();
+
+	if (filter.name && table.names[index] != *filter.name)
+		return false;
+	if (filter.type && table.types[index] != *filter.type)
+		return false;
+	if (filter.bundle && table.bundles[index] != *filter.bundle)
+		return false;
+	if (filter.language && table.LanguageName(index) != *filter.language)
+		return false;
+
+	return true;
+}
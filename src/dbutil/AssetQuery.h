@@ -0,0 +1,83 @@
+#pragma once
+
+#include "DB.h"
+
+#include <memory>
+#include <optional>
+
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * A query listing all the assets in the DB matching a filter, such as every asset of a given type, everything
+	 * in a bundle, or all the language versions of an asset.
+	 *
+	 * Rather than checking every file, the query scans the narrowest of the DB's sorted views that covers the
+	 * filter (see DieselDB::FilesByType) and only checks the files in that range. Results are produced one at a
+	 * time, so listing a huge number of assets doesn't need them all in memory at once.
+	 *
+	 * The query only stores a position, so it can be suspended and resumed later with Cursor and Seek - this is
+	 * used to hand results out in chunks. Cursors are only meaningful for the same version of the DB, see
+	 * DieselDB::Generation.
+	 *
+	 * The query keeps the version of the DB it was created with alive, so it won't change if the DB is reloaded.
+	 */
+	class AssetQuery
+	{
+	  public:
+		struct Filter
+		{
+			std::optional<idstring> name;
+			std::optional<idstring> type;
+			std::optional<uint32_t> bundle;   // Index into the DB's bundle table, see DieselDB::FindBundle
+			std::optional<idstring> language; // Zero matches files with no language
+		};
+
+		AssetQuery(std::shared_ptr<DieselDB> database, const Filter& filter);
+
+		/** Get the next matching file, or nullopt if there are none left. */
+		std::optional<DslFile> Next();
+
+		[[nodiscard]] bool Done() const;
+
+		/** The query's current position, which can be passed to Seek to carry on from here. */
+		[[nodiscard]] uint32_t Cursor() const
+		{
+			return pos;
+		}
+
+		/** The generation of the DB this query is running against. */
+		[[nodiscard]] uint64_t Generation() const
+		{
+			return db->Generation();
+		}
+
+		/** Move to a position previously returned by Cursor, on a query with the same filter. */
+		void Seek(uint32_t cursor)
+		{
+			pos = cursor;
+		}
+
+	  private:
+		enum class Mode
+		{
+			ALL,       // Scan every file, in index order
+			BY_TYPE,   // Scan a range of DieselDB::FilesByType
+			BY_BUNDLE, // Scan a range of DieselDB::FilesByBundle
+			LANGUAGES, // Walk the list of language versions of a single asset, pos is a file index and end is the
+			           // number of steps left
+		};
+
+		[[nodiscard]] bool Matches(uint32_t index) const;
+
+		std::shared_ptr<DieselDB> db;
+		Filter filter;
+		Mode mode = Mode::ALL;
+		const uint32_t* view = nullptr;
+		uint32_t end = 0;
+		uint32_t pos = 0;
+	};
+
+}; // namespace blt::db
@@ -0,0 +1,165 @@
+#include "BatchRead.h"
+
+#include <util/util.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define lseek64 _lseeki64
+#else
+#include <unistd.h>
+#endif
+
+using namespace blt::db;
+
+// If two assets are at most this far apart, read them (and whatever's between them) in one go. Reading a
+// little extra data is far cheaper than seeking on a mechanical drive.
+static const uint64_t MERGE_GAP = 64 * 1024;
+
+// Don't merge reads past this size, so reading lots of assets doesn't need a huge buffer. A single asset
+// larger than this is still read in one go.
+static const uint64_t MAX_MERGED_READ = 16 * 1024 * 1024;
+
+namespace
+{
+	struct PendingRead
+	{
+		// The length used for end-of-file assets, until the size of the bundle is known
+		static const uint64_t TO_END = ~(uint64_t)0;
+
+		size_t index;
+		uint64_t offset;
+		uint64_t length;
+	};
+} // namespace
+
+namespace
+{
+	// A bundle opened for reading, which is closed once all the reads from it are done
+	struct BundleFile
+	{
+		int fd = -1;
+
+		~BundleFile()
+		{
+			if (fd != -1)
+				close(fd);
+		}
+	};
+} // namespace
+
+// Read until the buffer is full or the end of the file is reached, returning how much was read
+static size_t readAt(int fd, uint64_t offset, uint8_t* data, size_t length)
+{
+	size_t done = 0;
+	while (done < length)
+	{
+#ifdef _WIN32
+		// There's no pread on Windows, but the file isn't shared between threads so seeking is fine
+		if (lseek64(fd, (int64_t)(offset + done), SEEK_SET) == -1)
+			PD2HOOK_SIMPLE_THROW_MSG(std::string("Failed to seek while reading: ") + strerror(errno));
+		int count = _read(fd, data + done, (unsigned int)std::min<size_t>(length - done, 1u << 30));
+#else
+		ssize_t count = pread(fd, data + done, length - done, (off_t)(offset + done));
+#endif
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			PD2HOOK_SIMPLE_THROW_MSG(std::string("Failed to read: ") + strerror(errno));
+		if (count == 0)
+			break;
+
+		done += (size_t)count;
+	}
+	return done;
+}
+
+static void readBundle(const DieselBundle& bundle, std::vector<PendingRead>& reads, std::vector<uint8_t>& buffer,
+                       const BatchReadCallback& callback)
+{
+	int flags = O_RDONLY;
+#ifdef _WIN32
+	// Windows Wart - suppress text file conversion
+	flags |= O_BINARY;
+#endif
+	BundleFile file;
+	file.fd = open(bundle.path.c_str(), flags);
+	if (file.fd == -1)
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open bundle " + bundle.path + ": " + strerror(errno));
+
+	int64_t size = lseek64(file.fd, 0, SEEK_END);
+	if (size == -1)
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to find the size of bundle " + bundle.path + ": " + strerror(errno));
+	uint64_t bundleSize = (uint64_t)size;
+
+	for (PendingRead& read : reads)
+	{
+		if (read.offset > bundleSize)
+			PD2HOOK_SIMPLE_THROW_MSG("Asset lies past the end of bundle " + bundle.path);
+
+		// End-of-file assets run until the end of the bundle
+		if (read.length == PendingRead::TO_END)
+			read.length = bundleSize - read.offset;
+		else if (read.length > bundleSize - read.offset)
+			PD2HOOK_SIMPLE_THROW_MSG("Asset lies past the end of bundle " + bundle.path);
+	}
+
+	std::sort(reads.begin(), reads.end(),
+	          [](const PendingRead& a, const PendingRead& b) { return a.offset < b.offset; });
+
+	for (size_t first = 0; first < reads.size();)
+	{
+		// Find all the assets we can read along with this one
+		uint64_t start = reads[first].offset;
+		uint64_t end = start + reads[first].length;
+		size_t last = first + 1;
+		for (; last < reads.size(); last++)
+		{
+			const PendingRead& read = reads[last];
+			uint64_t newEnd = std::max(end, read.offset + read.length);
+			if (read.offset > end + MERGE_GAP || newEnd - start > MAX_MERGED_READ)
+				break;
+			end = newEnd;
+		}
+
+		// The buffer is reused between reads, so it only grows as far as the largest one
+		buffer.resize(end - start);
+		if (readAt(file.fd, start, buffer.data(), buffer.size()) != buffer.size())
+			PD2HOOK_SIMPLE_THROW_MSG("Bundle " + bundle.path + " was cut short while reading it");
+
+		for (size_t i = first; i < last; i++)
+		{
+			callback(reads[i].index, buffer.data() + (reads[i].offset - start), reads[i].length);
+		}
+
+		first = last;
+	}
+}
+
+void blt::db::ReadFiles(const std::vector<DslFile>& files, const BatchReadCallback& callback)
+{
+	// The bundles are owned by the DB, so each one only has a single instance we can group by
+	std::map<const DieselBundle*, std::vector<PendingRead>> bundles;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		const DslFile& file = files[i];
+		if (!file.Found())
+			PD2HOOK_SIMPLE_THROW_MSG("Cannot read asset with no bundle");
+
+		uint64_t length = file.HasLength() ? file.length : PendingRead::TO_END;
+		bundles[file.bundle].push_back(PendingRead{i, file.offset, length});
+	}
+
+	std::vector<uint8_t> buffer;
+	for (auto& [bundle, reads] : bundles)
+	{
+		readBundle(*bundle, reads, buffer, callback);
+	}
+}
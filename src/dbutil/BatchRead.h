@@ -0,0 +1,32 @@
+#pragma once
+
+#include "DB.h"
+
+#include <functional>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * Called by ReadFiles with the index of an asset in the list passed to it, and that asset's contents. The
+	 * contents are only valid until the callback returns.
+	 */
+	using BatchReadCallback = std::function<void(size_t index, const uint8_t* data, size_t length)>;
+
+	/**
+	 * Read the contents of a list of assets.
+	 *
+	 * Rather than reading each asset separately, the assets are grouped by the bundle they're in and sorted
+	 * by their offset, so each bundle is only opened once and read from front to back. Assets which are next
+	 * to (or close to) each other are merged into a single larger read. This is much kinder to mechanical
+	 * drives than seeking back and forth across the bundles.
+	 *
+	 * The callback may be called for the assets in any order. Throws if any of the bundles can't be read.
+	 */
+	void ReadFiles(const std::vector<DslFile>& files, const BatchReadCallback& callback);
+
+}; // namespace blt::db
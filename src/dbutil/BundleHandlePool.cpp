@@ -0,0 +1,132 @@
+#include "BundleHandlePool.h"
+
+using namespace blt::db;
+
+BundleHandlePool& BundleHandlePool::Instance()
+{
+	static BundleHandlePool instance;
+	return instance;
+}
+
+std::shared_ptr<BLTSharedFile> BundleHandlePool::Get(const std::string& path)
+{
+	std::lock_guard guard(mutex);
+	return Find(files, path, [&]() { return BLTSharedFile::Open(path); });
+}
+
+std::shared_ptr<const MappedFile> BundleHandlePool::GetMapping(const std::string& path)
+{
+	std::lock_guard guard(mutex);
+
+	// Assets are read one at a time from all over the bundles, so there's no point reading ahead past them
+	return Find(mappings, path, [&]() { return MappedFile::Open(path, MappedFile::Access::Normal); });
+}
+
+void BundleHandlePool::SetIdleCapacity(size_t count)
+{
+	std::lock_guard guard(mutex);
+	capacity = count;
+	Trim(files);
+	Trim(mappings);
+}
+
+BundleHandlePool::Stats BundleHandlePool::GetStats() const
+{
+	std::lock_guard guard(mutex);
+
+	Stats stats = {0, 0, 0, 0, capacity};
+	AddStats(files, stats);
+	AddStats(mappings, stats);
+	return stats;
+}
+
+void BundleHandlePool::Clear()
+{
+	std::lock_guard guard(mutex);
+	files.recent.clear();
+	files.entries.clear();
+	mappings.recent.clear();
+	mappings.entries.clear();
+}
+
+template <typename T, typename OpenFn>
+std::shared_ptr<T> BundleHandlePool::Find(Handles<T>& handles, const std::string& path, OpenFn open)
+{
+	auto iter = handles.entries.find(path);
+	if (iter != handles.entries.end())
+	{
+		auto& entry = iter->second;
+		std::shared_ptr<T> handle = entry.handle.lock();
+		if (handle)
+		{
+			handles.hits++;
+
+			// Move it to the front, since it's now the most recently used
+			if (entry.recent != handles.recent.end())
+			{
+				handles.recent.splice(handles.recent.begin(), handles.recent, entry.recent);
+			}
+			else if (capacity > 0)
+			{
+				handles.recent.emplace_front(path, handle);
+				entry.recent = handles.recent.begin();
+				Trim(handles);
+			}
+
+			return handle;
+		}
+
+		// All the datastores using it have gone away, and it fell off the recent list
+		handles.entries.erase(iter);
+	}
+
+	// Opening the file while holding the lock means two threads can't both open the same bundle. Since this
+	// is just an open and seek (or mmap), it doesn't hold up other threads for long.
+	handles.misses++;
+	std::shared_ptr<T> handle = open();
+	if (!handle)
+		return nullptr;
+
+	auto& entry = handles.entries[path];
+	entry.handle = handle;
+	entry.recent = handles.recent.end();
+	if (capacity > 0)
+	{
+		handles.recent.emplace_front(path, handle);
+		entry.recent = handles.recent.begin();
+	}
+	Trim(handles);
+
+	return handle;
+}
+
+template <typename T> void BundleHandlePool::Trim(Handles<T>& handles)
+{
+	while (handles.recent.size() > capacity)
+	{
+		auto& last = handles.recent.back();
+		auto iter = handles.entries.find(last.first);
+
+		// If nothing else is using it, this closes it and there's no point remembering it. Otherwise keep track
+		// of it, so it's shared with any new datastores for as long as the existing ones are around.
+		if (last.second.use_count() == 1)
+			handles.entries.erase(iter);
+		else
+			iter->second.recent = handles.recent.end();
+
+		handles.recent.pop_back();
+	}
+}
+
+template <typename T> void BundleHandlePool::AddStats(const Handles<T>& handles, Stats& stats) const
+{
+	stats.hits += handles.hits;
+	stats.misses += handles.misses;
+	stats.recent += handles.recent.size();
+
+	for (const auto& pair : handles.entries)
+	{
+		if (!pair.second.handle.expired())
+			stats.open++;
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Datastore.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * A process-wide pool of open bundle files, shared between all the datastores reading from them.
+	 *
+	 * Each bundle is only ever open once, no matter how many datastores the engine is holding on to for it. When
+	 * the last of those is released the file isn't closed straight away: the most recently used bundles are kept
+	 * open, so loading several hooked assets from the same bundle doesn't keep opening and closing it. This also
+	 * puts a limit on the number of files open for bundles that aren't in use. It's safe to use from any thread.
+	 *
+	 * Bundles may also be memory mapped, which works the same way but keeps track of the mappings separately.
+	 */
+	class BundleHandlePool
+	{
+	  public:
+		// The number of bundles to keep open (and separately, to keep mapped) after they're no longer in use
+		static const size_t DEFAULT_IDLE_CAPACITY = 64;
+
+		struct Stats
+		{
+			uint64_t hits;   // Files which were already open
+			uint64_t misses; // Files which had to be opened
+			size_t open;     // Files currently open, whether they're in use or not
+			size_t recent;   // Recently used files, which are kept open even once they're no longer in use
+			size_t capacity;
+		};
+
+		static BundleHandlePool& Instance();
+
+		/** Get the open file for a bundle, opening it if necessary. Returns null if it can't be opened. */
+		std::shared_ptr<BLTSharedFile> Get(const std::string& path);
+
+		/** Get a memory mapping of a bundle, mapping it if necessary. Returns null if it can't be mapped. */
+		std::shared_ptr<const MappedFile> GetMapping(const std::string& path);
+
+		/** Set the number of bundles to keep open once they're no longer in use. Zero closes them immediately. */
+		void SetIdleCapacity(size_t count);
+
+		/** Get the stats for the open files and the mappings, added together. */
+		[[nodiscard]] Stats GetStats() const;
+
+		/**
+		 * Close all the bundles which aren't in use, and open any others again the next time they're used. This
+		 * is used when the bundles may have been replaced. Datastores still using the old files keep working.
+		 */
+		void Clear();
+
+	  private:
+		BundleHandlePool() = default;
+
+		// The open files or mappings of the bundles
+		template <typename T> struct Handles
+		{
+			using Recent = std::pair<std::string, std::shared_ptr<T>>;
+
+			struct Entry
+			{
+				std::weak_ptr<T> handle;
+				typename std::list<Recent>::iterator recent; // Or the end of the recent list, if it's not there
+			};
+
+			std::list<Recent> recent; // Most recently used first, keeping these open
+			std::unordered_map<std::string, Entry> entries;
+
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+		};
+
+		// Find an existing handle, or open a new one. Must hold the mutex.
+		template <typename T, typename OpenFn>
+		std::shared_ptr<T> Find(Handles<T>& handles, const std::string& path, OpenFn open);
+
+		// Let go of the least recently used handles until there's no more than the capacity. Must hold the mutex.
+		template <typename T> void Trim(Handles<T>& handles);
+
+		template <typename T> void AddStats(const Handles<T>& handles, Stats& stats) const;
+
+		mutable std::mutex mutex;
+		Handles<BLTSharedFile> files;
+		Handles<const MappedFile> mappings;
+
+		size_t capacity = DEFAULT_IDLE_CAPACITY;
+	};
+
+}; // namespace blt::db
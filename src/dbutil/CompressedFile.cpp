@@ -0,0 +1,204 @@
+#include "CompressedFile.h"
+
+#include <util/util.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+using namespace blt::db::compressed;
+
+std::vector<uint8_t> blt::db::compressed::Compress(const uint8_t* data, size_t length, uint32_t chunkSize, int level)
+{
+	if (chunkSize == 0)
+		PD2HOOK_SIMPLE_THROW_MSG("The chunk size must not be zero");
+
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.chunkSize = chunkSize;
+	header.size = length;
+
+	std::vector<uint8_t> out(sizeof(header));
+	memcpy(out.data(), &header, sizeof(header));
+
+	std::vector<uint64_t> offsets;
+	for (size_t pos = 0; pos < length; pos += chunkSize)
+	{
+		size_t chunkLength = std::min<size_t>(chunkSize, length - pos);
+		offsets.push_back(out.size());
+
+		uLongf compressedLength = compressBound((uLong)chunkLength);
+		size_t start = out.size();
+		out.resize(start + compressedLength);
+
+		int res = compress2(out.data() + start, &compressedLength, data + pos, (uLong)chunkLength, level);
+		if (res != Z_OK)
+			PD2HOOK_SIMPLE_THROW_MSG("Failed to compress chunk: zlib error " + std::to_string(res));
+
+		out.resize(start + compressedLength);
+	}
+	offsets.push_back(out.size());
+
+	Footer footer;
+	footer.indexOffset = out.size();
+	memcpy(footer.magic, FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+
+	size_t indexStart = out.size();
+	out.resize(indexStart + offsets.size() * sizeof(uint64_t) + sizeof(footer));
+	memcpy(out.data() + indexStart, offsets.data(), offsets.size() * sizeof(uint64_t));
+	memcpy(out.data() + out.size() - sizeof(footer), &footer, sizeof(footer));
+
+	return out;
+}
+
+// BLTCompressedDataStore
+
+bool BLTCompressedDataStore::IsCompressed(BLTSharedFile& file)
+{
+	char magic[sizeof(MAGIC)];
+	if (file.ReadAt(0, (uint8_t*)magic, sizeof(magic)) != sizeof(magic))
+		return false;
+
+	return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+BLTCompressedDataStore* BLTCompressedDataStore::Open(std::shared_ptr<BLTSharedFile> file, const std::string& filePath)
+{
+	auto fail = [&](const std::string& reason) -> BLTCompressedDataStore* {
+		PD2HOOK_LOG_ERROR("Invalid compressed file '" + filePath + "': " + reason);
+		return nullptr;
+	};
+
+	Header header;
+	Footer footer;
+	if (file->Size() < sizeof(header) + sizeof(footer))
+		return fail("too short");
+
+	file->ReadAt(0, (uint8_t*)&header, sizeof(header));
+	file->ReadAt(file->Size() - sizeof(footer), (uint8_t*)&footer, sizeof(footer));
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+		return fail("bad magic");
+	if (header.version != VERSION)
+		return fail("unsupported version " + std::to_string(header.version));
+	if (memcmp(footer.magic, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) != 0)
+		return fail("bad footer, it may have been cut short");
+	if (header.chunkSize == 0)
+		return fail("zero chunk size");
+
+	uint64_t chunkCount = (header.size + header.chunkSize - 1) / header.chunkSize;
+	uint64_t indexEnd = file->Size() - sizeof(footer);
+	if (footer.indexOffset > indexEnd || (indexEnd - footer.indexOffset) != (chunkCount + 1) * sizeof(uint64_t))
+		return fail("index doesn't match the size of the file");
+
+	std::unique_ptr<BLTCompressedDataStore> ds(new BLTCompressedDataStore());
+	ds->offsets.resize(chunkCount + 1);
+	file->ReadAt(footer.indexOffset, (uint8_t*)ds->offsets.data(), ds->offsets.size() * sizeof(uint64_t));
+
+	// Check the chunks are in order and inside the file, so reading them can't go anywhere strange
+	uint64_t last = sizeof(header);
+	for (uint64_t offset : ds->offsets)
+	{
+		if (offset < last || offset > footer.indexOffset)
+			return fail("chunk offsets are out of order");
+		last = offset;
+	}
+
+	ds->file = std::move(file);
+	ds->path = filePath;
+	ds->chunkSize = header.chunkSize;
+	ds->uncompressedSize = header.size;
+	return ds.release();
+}
+
+const std::vector<uint8_t>* BLTCompressedDataStore::GetChunk(size_t index)
+{
+	for (auto iter = chunks.begin(); iter != chunks.end(); ++iter)
+	{
+		if (iter->index != index)
+			continue;
+
+		chunks.splice(chunks.begin(), chunks, iter);
+		return &chunks.front().data;
+	}
+
+	// Reuse the least recently used chunk's buffer, if the cache is full
+	Chunk chunk;
+	if (chunks.size() >= CACHED_CHUNKS)
+	{
+		chunk = std::move(chunks.back());
+		chunks.pop_back();
+	}
+	chunk.index = index;
+
+	uint64_t start = offsets[index];
+	std::vector<uint8_t> compressed(offsets[index + 1] - start);
+	if (file->ReadAt(start, compressed.data(), compressed.size()) != compressed.size())
+	{
+		PD2HOOK_LOG_ERROR("Failed to read chunk " + std::to_string(index) + " of compressed file '" + path + "'");
+		return nullptr;
+	}
+
+	uLongf expected = (uLongf)std::min<uint64_t>(chunkSize, uncompressedSize - (uint64_t)index * chunkSize);
+	uLongf length = expected;
+	chunk.data.resize(expected);
+	int res = uncompress(chunk.data.data(), &length, compressed.data(), (uLong)compressed.size());
+	if (res != Z_OK || length != expected)
+	{
+		PD2HOOK_LOG_ERROR("Failed to decompress chunk " + std::to_string(index) + " of compressed file '" + path +
+		                  "': zlib error " + std::to_string(res));
+		return nullptr;
+	}
+
+	chunks.push_front(std::move(chunk));
+	return &chunks.front().data;
+}
+
+size_t BLTCompressedDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	if (position_in_file >= uncompressedSize)
+		return 0;
+	length = (size_t)std::min<uint64_t>(length, uncompressedSize - position_in_file);
+
+	std::lock_guard guard(mutex);
+
+	size_t done = 0;
+	while (done < length)
+	{
+		uint64_t pos = position_in_file + done;
+		const std::vector<uint8_t>* chunk = GetChunk((size_t)(pos / chunkSize));
+		if (!chunk)
+			break;
+
+		size_t offset = (size_t)(pos % chunkSize);
+		size_t count = std::min(length - done, chunk->size() - offset);
+		memcpy(data + done, chunk->data() + offset, count);
+		done += count;
+	}
+
+	return done;
+}
+
+bool BLTCompressedDataStore::close()
+{
+	PD2HOOK_LOG_ERROR("BLTCompressedDataStore::close called - unimplemented!");
+	abort();
+}
+
+size_t BLTCompressedDataStore::size() const
+{
+	return (size_t)uncompressedSize;
+}
+
+bool BLTCompressedDataStore::is_asynchronous() const
+{
+	return false;
+}
+
+bool BLTCompressedDataStore::good() const
+{
+	return true;
+}
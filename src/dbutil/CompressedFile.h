@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Datastore.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db::compressed
+{
+
+	/**
+	 * Mods may ship their loose asset files compressed in this format, which SuperBLT decompresses as the game
+	 * reads them. The file is split into fixed-size chunks which are compressed separately, so reading part of
+	 * the file only needs to decompress the chunks that part lies in.
+	 *
+	 * This only works for files SuperBLT opens itself (see DieselDB::OpenFile): the plain files of Wren asset
+	 * hooks, and on Linux the files registered with DB:create_entry. On Windows the game opens the latter itself,
+	 * so they can't be compressed there.
+	 *
+	 * The layout is:
+	 *   Header
+	 *   The chunks, each one compressed with zlib
+	 *   The index: the offset of each chunk in the file, followed by the offset of the end of the last chunk
+	 *   Footer
+	 *
+	 * All the values are little-endian.
+	 */
+
+	// The magic bytes at the start of a compressed file
+	static const char MAGIC[8] = {'S', 'B', 'L', 'T', 'Z', 'C', 'K', '1'};
+
+	// The magic bytes at the end of a compressed file, to check it wasn't cut short
+	static const char FOOTER_MAGIC[8] = {'S', 'B', 'L', 'T', 'Z', 'I', 'D', 'X'};
+
+	static const uint32_t VERSION = 1;
+
+	// Small enough that reading a few bytes doesn't decompress much, but big enough to still compress well
+	static const uint32_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t chunkSize;
+		uint64_t size; // The size of the file once it's decompressed
+	};
+	static_assert(sizeof(Header) == 24, "Compressed file header has the wrong size");
+
+	struct Footer
+	{
+		uint64_t indexOffset;
+		char magic[8];
+	};
+	static_assert(sizeof(Footer) == 16, "Compressed file footer has the wrong size");
+
+	/** Compress the contents of a file into this format. Throws if zlib fails. */
+	std::vector<uint8_t> Compress(const uint8_t* data, size_t length, uint32_t chunkSize = DEFAULT_CHUNK_SIZE,
+	                              int level = 9);
+
+}; // namespace blt::db::compressed
+
+// Reads from a file in the format described above, decompressing only the chunks that are read. The most
+// recently used chunks are kept around, since the game tends to read files in lots of small pieces.
+class BLTCompressedDataStore : public BLTAbstractDataStore
+{
+  public:
+	// The number of decompressed chunks to keep
+	static const size_t CACHED_CHUNKS = 4;
+
+	// Delete default crap
+	BLTCompressedDataStore(const BLTCompressedDataStore&) = delete;
+	BLTCompressedDataStore& operator=(const BLTCompressedDataStore&) = delete;
+
+	/** Check if an open file is compressed, by looking at it's magic bytes. */
+	static bool IsCompressed(BLTSharedFile& file);
+
+	/** Read a compressed file's index. Returns null (and logs why) if it's not a valid compressed file. */
+	static BLTCompressedDataStore* Open(std::shared_ptr<BLTSharedFile> file, const std::string& filePath);
+
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	BLTCompressedDataStore() = default;
+
+	struct Chunk
+	{
+		size_t index;
+		std::vector<uint8_t> data;
+	};
+
+	// Get the decompressed contents of a chunk, or null if it's corrupt. Must hold the mutex.
+	const std::vector<uint8_t>* GetChunk(size_t index);
+
+	std::shared_ptr<BLTSharedFile> file;
+	std::string path;
+	uint32_t chunkSize = 0;
+	uint64_t uncompressedSize = 0;
+	std::vector<uint64_t> offsets; // The offset of each chunk, plus the end of the last one
+
+	std::mutex mutex;
+	std::list<Chunk> chunks; // Most recently used first
+};
@@ -1,27 +1,45 @@
 #include "DB.h"
+#include "AssetCache.h"
+#include "BundleHandlePool.h"
+#include "CompressedFile.h"
+#include "DBFormat.h"
+#include "DBWatcher.h"
+#include "MappedFile.h"
 
 #include <util/util.h>
 
 #include <algorithm>
-#include <fstream>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 #endif
 
 using namespace blt::db;
+using namespace blt::db::format;
 using blt::idstring;
 
 static_assert(sizeof(void*) == sizeof(intptr_t));
-using pos_t = std::ios::pos_type;
-using FileList = std::vector<DslFile>&;
-using FileMap = std::map<std::pair<idstring, idstring>, DslFile*>&;
 
 static uint64_t monotonicTimeMicros()
 {
@@ -44,58 +62,259 @@ static uint64_t monotonicTimeMicros()
 #endif
 }
 
-struct dsl_Vector
+/**
+ * A view of an array of records stored in a memory-mapped file.
+ *
+ * The records are copied out one at a time as they're accessed, since there's no guarantee they're
+ * suitably aligned within the file.
+ */
+template <typename T> class RecordView
 {
-	unsigned int size;
-	unsigned int capacity;
-	intptr_t contents_ptr;
-	void* allocator;
+  public:
+	class iterator
+	{
+	  public:
+		explicit iterator(const uint8_t* ptr) : ptr(ptr)
+		{
+		}
+
+		T operator*() const
+		{
+			T value;
+			memcpy(&value, ptr, sizeof(T));
+			return value;
+		}
+
+		iterator& operator++()
+		{
+			ptr += sizeof(T);
+			return *this;
+		}
+
+		bool operator!=(const iterator& other) const
+		{
+			return ptr != other.ptr;
+		}
+
+	  private:
+		const uint8_t* ptr;
+	};
+
+	RecordView(const uint8_t* start, size_t count) : start(start), count(count)
+	{
+	}
+
+	[[nodiscard]] size_t size() const
+	{
+		return count;
+	}
+
+	T operator[](size_t i) const
+	{
+		return *iterator(start + i * sizeof(T));
+	}
+
+	[[nodiscard]] iterator begin() const
+	{
+		return iterator(start);
+	}
+
+	[[nodiscard]] iterator end() const
+	{
+		return iterator(start + count * sizeof(T));
+	}
+
+  private:
+	const uint8_t* start;
+	size_t count;
 };
 
-static void skipVector(std::istream& in)
+/**
+ * Reads values from a memory-mapped file, checking that everything it reads lies within the file.
+ */
+class MappedReader
 {
-	in.seekg(sizeof(dsl_Vector), std::ios::cur);
+  public:
+	explicit MappedReader(const MappedFile& file) : file(file)
+	{
+	}
 
-	// Suppress the unused function warning
-	(void)skipVector;
-}
+	void Skip(size_t amount)
+	{
+		Check(pos, amount);
+		pos += amount;
+	}
 
-template <typename T> static std::vector<T> loadVector(std::istream& in, int offset, dsl_Vector& vec)
-{
-	std::vector<T> data;
-	data.resize(vec.size);
+	template <typename T> T Read()
+	{
+		Check(pos, sizeof(T));
+		T value;
+		memcpy(&value, file.data() + pos, sizeof(T));
+		pos += sizeof(T);
+		return value;
+	}
 
-	// Read the vector contents
-	pos_t pos = in.tellg();
-	in.seekg(vec.contents_ptr + offset);
-	in.read((char*)data.data(), sizeof(T) * data.size());
-	in.seekg(pos);
+	template <typename T> RecordView<T> View(size_t offset, size_t count) const
+	{
+		// Make sure the multiplication can't overflow before checking the bounds
+		if (count > file.size() / sizeof(T))
+			Fail(offset, count * sizeof(T));
+		Check(offset, count * sizeof(T));
+		return RecordView<T>(file.data() + offset, count);
+	}
 
-	return data;
+  private:
+	void Check(size_t offset, size_t amount) const
+	{
+		if (offset > file.size() || amount > file.size() - offset)
+			Fail(offset, amount);
+	}
+
+	[[noreturn]] void Fail(size_t offset, size_t amount) const
+	{
+		char buff[1024];
+		memset(buff, 0, sizeof(buff));
+		snprintf(buff, sizeof(buff) - 1, "Corrupt DB file '%s': read of %zu bytes at %zu is past the end (%zu bytes)",
+		         file.path().c_str(), amount, offset, file.size());
+		PD2HOOK_SIMPLE_THROW_MSG(buff);
+	}
+
+	const MappedFile& file;
+	size_t pos = 0;
+};
+
+static std::unique_ptr<MappedFile> mapDbFile(const std::string& path)
+{
+	std::unique_ptr<MappedFile> file = MappedFile::Open(path);
+	if (!file)
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open DB file '" + path + "'");
+	return file;
 }
 
-template <typename T> static std::vector<T> loadVector(std::istream& in, int offset)
+template <typename T> static RecordView<T> loadVector(MappedReader& in, int offset, const dsl_Vector& vec)
 {
-	// Read the vector metadata
-	dsl_Vector vec = {0};
-	in.read((char*)&vec, sizeof(vec));
+	return in.View<T>(vec.contents_ptr + offset, vec.size);
+}
 
+template <typename T> static RecordView<T> loadVector(MappedReader& in, int offset)
+{
+	// Read the vector metadata
+	dsl_Vector vec = in.Read<dsl_Vector>();
 	return loadVector<T>(in, offset, vec);
 }
 
+/**
+ * A change to a file's location, read from one of the bundle headers.
+ */
+struct HeaderEntry
+{
+	uint32_t bundle; // Index into the task's list of bundles
+	uint32_t file;   // Index into the file list
+	uint32_t offset;
+	uint32_t length;
+
+	// Package headers don't specify the length of their last file, in which case the existing length is kept
+	bool setLength;
+};
+
+/**
+ * The work of parsing a single bundle header, which may be run on any thread.
+ */
+struct HeaderTask
+{
+	std::function<void(HeaderTask&)> run;
+
+	// The results, which are only applied once all the headers have been parsed
+	std::vector<HeaderEntry> entries;
+	std::vector<DieselBundle> bundles;
+	std::exception_ptr error;
+};
+
+static const size_t MAX_HEADER_THREADS = 8;
+
+static std::vector<std::string> listPackageHeaders();
+static void runHeaderTasks(std::vector<HeaderTask>& tasks);
+static void loadPackageHeader(const std::string& filename, size_t fileCount, std::vector<HeaderEntry>& entries);
+static void loadBundleHeader(const std::string& filename, size_t fileCount, std::vector<HeaderEntry>& entries,
+                             std::vector<DieselBundle>& bundles);
+static uint32_t fileIndex(int64_t fileId, size_t fileCount);
+
 static std::mutex db_setup_mutex;
 
-DieselDB* DieselDB::Instance()
+// The current version of the DB. This is always accessed through the atomic shared_ptr functions, so it can be
+// replaced while other threads are using it.
+static std::shared_ptr<DieselDB> current_db;
+static std::atomic<uint64_t> db_generation{0};
+
+std::shared_ptr<DieselDB> DieselDB::Instance()
 {
+	std::shared_ptr<DieselDB> db = std::atomic_load(&current_db);
+	if (db)
+		return db;
+
 	// Make sure we can't go setting it up twice in parallel
 	std::lock_guard guard(db_setup_mutex);
 
-	static DieselDB instance;
-	return &instance;
+	db = std::atomic_load(&current_db);
+	if (db)
+		return db;
+
+	db = std::shared_ptr<DieselDB>(new DieselDB());
+	std::atomic_store(&current_db, db);
+
+	// Now there's a DB to replace, start looking out for the bundles changing
+	WatchForChanges();
+
+	return db;
 }
 
-static void loadPackageHeader(DieselBundle* bundle, FileList);
-static void loadBundleHeader(std::string filename, FileList);
+std::shared_ptr<DieselDB> DieselDB::InstanceIfLoaded()
+{
+	return std::atomic_load(&current_db);
+}
+
+uint64_t DieselDB::CurrentFingerprint()
+{
+	return Fingerprint(listPackageHeaders());
+}
+
+bool DieselDB::Reload()
+{
+	// Only one reload at a time, and not while the DB is being loaded for the first time
+	std::lock_guard guard(db_setup_mutex);
+
+	std::shared_ptr<DieselDB> old = std::atomic_load(&current_db);
+	if (!old)
+		return false;
+
+	// The headers might have been touched without actually changing, or changed and then put back
+	if (Fingerprint(listPackageHeaders()) == old->fingerprint)
+		return false;
+
+	PD2HOOK_LOG_LOG("Game files have changed, reloading DB info");
+
+	std::shared_ptr<DieselDB> db;
+	try
+	{
+		db = std::shared_ptr<DieselDB>(new DieselDB());
+	}
+	catch (const std::exception& ex)
+	{
+		// This may happen if the bundles are still being written, in which case we'll try again when they're done
+		PD2HOOK_LOG_ERROR(std::string("Failed to reload DB info, keeping the old version: ") + ex.what());
+		return false;
+	}
+
+	std::atomic_store(&current_db, db);
+
+	// Nothing can hit the old DB's entries in the cache any more, so free them
+	AssetCache::Instance().Clear();
+
+	// Bundles which were replaced need to be opened again, rather than reading from the old files
+	BundleHandlePool::Instance().Clear();
+
+	return true;
+}
 
 ////////////////////////
 ////// DSL FILE ////////
@@ -117,6 +336,303 @@ std::vector<uint8_t> DslFile::ReadContents(std::istream& fi) const
 	return data;
 }
 
+// Read from a file around the OS's file cache. The file must be read in aligned blocks, so this reads through an
+// aligned bounce buffer and copies out the part that was asked for. Returns false without reading anything if the
+// file can't be read this way, otherwise sets error if a read fails part way through.
+static bool readDirect(const std::string& path, uint64_t position, uint8_t* data, size_t length, std::string& error)
+{
+	// This covers the sector size of any disk, and the page size
+	const size_t ALIGNMENT = 4096;
+	const size_t BOUNCE_SIZE = 4 * 1024 * 1024;
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                            FILE_FLAG_NO_BUFFERING, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	std::unique_ptr<uint8_t, void (*)(void*)> bounce((uint8_t*)_aligned_malloc(BOUNCE_SIZE, ALIGNMENT), _aligned_free);
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+	if (fd == -1)
+		return false;
+
+	void* memory = nullptr;
+	if (posix_memalign(&memory, ALIGNMENT, BOUNCE_SIZE) != 0)
+		memory = nullptr;
+	std::unique_ptr<uint8_t, void (*)(void*)> bounce((uint8_t*)memory, free);
+#endif
+
+	bool supported = true;
+	for (size_t done = 0; bounce && done < length;)
+	{
+		// Start from the block the next byte is in, and read whole blocks up to the end of the read
+		uint64_t position_in_file = position + done;
+		uint64_t aligned = position_in_file & ~(uint64_t)(ALIGNMENT - 1);
+		size_t head = (size_t)(position_in_file - aligned);
+		size_t want = std::min<size_t>(BOUNCE_SIZE, (head + (length - done) + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+
+#ifdef _WIN32
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)aligned;
+		overlapped.OffsetHigh = (DWORD)(aligned >> 32);
+		DWORD read = 0;
+		bool ok = ReadFile(handle, bounce.get(), (DWORD)want, &read, &overlapped);
+		if (!ok && done == 0 && GetLastError() == ERROR_INVALID_PARAMETER)
+			supported = false;
+		const char* reason = "IO error";
+#else
+		ssize_t read = pread(fd, bounce.get(), want, (off_t)aligned);
+		bool ok = read >= 0;
+		if (!ok && done == 0 && errno == EINVAL)
+			supported = false;
+		const char* reason = strerror(errno);
+#endif
+
+		if (!supported)
+			break;
+
+		if (ok && (size_t)read <= head)
+		{
+			ok = false;
+			reason = "unexpected end of file";
+		}
+		if (!ok)
+		{
+			error = "Failed to read from bundle " + path + ": " + reason;
+			break;
+		}
+
+		size_t count = std::min<size_t>((size_t)read - head, length - done);
+		memcpy(data + done, bounce.get() + head, count);
+		done += count;
+	}
+
+#ifdef _WIN32
+	CloseHandle(handle);
+#else
+	close(fd);
+#endif
+
+	// If the bounce buffer couldn't be allocated, read normally instead
+	return supported && bounce;
+}
+
+std::vector<uint8_t> DslFile::ReadRange(uint64_t start, uint64_t count, bool direct) const
+{
+	if (!Found())
+		PD2HOOK_SIMPLE_THROW_MSG("Cannot read asset: it's not in any bundle");
+
+	const std::string& path = bundle->path;
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                            FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open bundle " + path);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size))
+	{
+		CloseHandle(handle);
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to find the size of bundle " + path);
+	}
+	uint64_t bundleSize = (uint64_t)size.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open bundle " + path + ": " + strerror(errno));
+
+	struct stat info = {};
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to find the size of bundle " + path + ": " + strerror(errno));
+	}
+	uint64_t bundleSize = (uint64_t)info.st_size;
+#endif
+
+	// End-of-file assets run until the end of the bundle, so their length comes from the bundle's size
+	uint64_t assetLength = HasLength() ? length : bundleSize - std::min<uint64_t>(offset, bundleSize);
+
+	std::string error;
+	if (offset + assetLength > bundleSize)
+		error = "Asset lies past the end of bundle " + path;
+	else if (start > assetLength)
+		error = "Cannot read from byte " + std::to_string(start) + " of an asset that is only " +
+		        std::to_string(assetLength) + " bytes long";
+
+	count = std::min(count, assetLength - std::min(start, assetLength));
+	std::vector<uint8_t> data(error.empty() ? count : 0);
+
+	// This opens the bundle again, since it has to be opened specially
+	bool readAlready = false;
+	if (error.empty() && direct && count >= DIRECT_READ_THRESHOLD)
+		readAlready = readDirect(path, offset + start, data.data(), data.size(), error);
+
+	for (size_t done = 0; error.empty() && !readAlready && done < data.size();)
+	{
+		uint64_t position = offset + start + done;
+#ifdef _WIN32
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)position;
+		overlapped.OffsetHigh = (DWORD)(position >> 32);
+		DWORD read = 0;
+		DWORD toRead = (DWORD)std::min<size_t>(data.size() - done, 0x40000000);
+		bool ok = ReadFile(handle, data.data() + done, toRead, &read, &overlapped) && read != 0;
+		const char* reason = "IO error";
+#else
+		ssize_t read = pread(fd, data.data() + done, data.size() - done, (off_t)position);
+		bool ok = read > 0;
+		const char* reason = read == 0 ? "unexpected end of file" : strerror(errno);
+#endif
+
+		if (!ok)
+			error = "Failed to read from bundle " + path + ": " + reason;
+		else
+			done += (size_t)read;
+	}
+
+#ifdef _WIN32
+	CloseHandle(handle);
+#else
+	close(fd);
+#endif
+
+	if (!error.empty())
+		PD2HOOK_SIMPLE_THROW_MSG(error);
+
+	return data;
+}
+
+////////////////////////
+///// FILE TABLE ///////
+////////////////////////
+
+void DslFileTable::Reset(size_t size)
+{
+	count = size;
+	names.Reset(count, 0);
+	types.Reset(count, 0);
+	languages.Reset(count, 0);
+	next.Reset(count, NONE);
+	bundles.Reset(count, NONE);
+	offsets.Reset(count, ~0u);
+	lengths.Reset(count, ~0u);
+
+	// Language zero is always 'no language'
+	languageTable.clear();
+	languageTable.push_back(Language{0, 0, 0});
+}
+
+uint16_t DslFileTable::AddLanguage(int32_t rawId, idstring name)
+{
+	for (size_t i = 0; i < languageTable.size(); i++)
+	{
+		if (languageTable[i].rawId == rawId)
+			return (uint16_t)i;
+	}
+
+	if (languageTable.size() > UINT16_MAX)
+		PD2HOOK_SIMPLE_THROW_MSG("Too many languages in the asset DB");
+
+	languageTable.push_back(Language{rawId, 0, name});
+	return (uint16_t)(languageTable.size() - 1);
+}
+
+std::optional<uint16_t> DslFileTable::FindLanguage(idstring name) const
+{
+	for (size_t i = 0; i < languageTable.size(); i++)
+	{
+		if (languageTable[i].name == name)
+			return (uint16_t)i;
+	}
+
+	return std::nullopt;
+}
+
+idstring DslFileTable::LanguageName(uint32_t index) const
+{
+	uint16_t language = languages[index];
+	return language < languageTable.size() ? languageTable[language].name : 0;
+}
+
+size_t DslFileTable::HeapSize() const
+{
+	return names.HeapSize() + types.HeapSize() + languages.HeapSize() + next.HeapSize() + bundles.HeapSize() +
+	       offsets.HeapSize() + lengths.HeapSize() + languageTable.capacity() * sizeof(Language);
+}
+
+DslFile DslFileTable::Get(uint32_t index, const std::vector<DieselBundle*>& bundleTable) const
+{
+	DslFile fi;
+	fi.name = names[index];
+	fi.type = types[index];
+	fi.fileId = (int)index + 1;
+
+	// The links are bounds-checked here rather than when the table is loaded, so a snapshot can be used
+	// without having to read through the whole thing first.
+	uint16_t language = languages[index];
+	if (language < languageTable.size())
+	{
+		fi.rawLangId = languageTable[language].rawId;
+		fi.langId = languageTable[language].name;
+	}
+	else
+	{
+		fi.rawLangId = 0;
+		fi.langId = 0;
+	}
+
+	fi.next = next[index] < count ? next[index] : NONE;
+
+	uint32_t bundle = bundles[index];
+	if (bundle < bundleTable.size())
+	{
+		fi.bundle = bundleTable[bundle];
+		fi.offset = offsets[index];
+		fi.length = lengths[index];
+	}
+
+	return fi;
+}
+
+////////////////////////
+////// FILE INDEX //////
+////////////////////////
+
+void FileIndex::Reset(size_t capacity)
+{
+	// Keep the load factor at or below 3/4, since probe lengths grow quickly past that
+	size_t size = 16;
+	while (size < capacity + capacity / 3)
+		size *= 2;
+
+	slots.Reset(size, Slot{0, 0, EMPTY, 0, 0});
+	mask = size - 1;
+}
+
+void FileIndex::Attach(const Slot* data, size_t count)
+{
+	assert(count != 0 && (count & (count - 1)) == 0);
+
+	slots.Attach(data);
+	mask = count - 1;
+}
+
+FileIndex::Slot& FileIndex::Locate(idstring name, idstring type, uint16_t language)
+{
+	Slot* writable = slots.Writable();
+	assert(writable == slots.Data());
+
+	for (size_t i = Start(name, type, language);; i = (i + 1) & mask)
+	{
+		Slot& slot = writable[i];
+		if (slot.file == EMPTY || (slot.name == name && slot.type == type && slot.language == language))
+			return slot;
+	}
+}
+
 ////////////////////////
 ////// DIESEL DB ///////
 ////////////////////////
@@ -126,82 +642,302 @@ DieselDB::DieselDB()
 	uint64_t start_time = monotonicTimeMicros();
 	PD2HOOK_LOG_LOG("Start loading DB info");
 
-	std::ifstream in;
-	in.exceptions(std::ios::failbit | std::ios::badbit);
-	in.open("assets/bundle_db.blb", std::ios::binary);
+	// If nothing has changed since the last time we started, use the cached copy of the index. Otherwise
+	// parse everything again and update the cache for next time.
+	generation = ++db_generation;
+
+	// Record how long each step takes, for profiling
+	uint64_t stepStart = start_time;
+	auto endStep = [&stepStart](uint64_t& time) {
+		uint64_t now = monotonicTimeMicros();
+		time = now - stepStart;
+		stepStart = now;
+	};
+
+	std::vector<std::string> packageHeaders = listPackageHeaders();
+	endStep(loadTimes.listHeaders);
+	fingerprint = Fingerprint(packageHeaders);
+	endStep(loadTimes.fingerprint);
+
+	const char* source = "cache";
+	loadTimes.fromSnapshot = LoadSnapshot(fingerprint);
+	endStep(loadTimes.loadSnapshot);
+	if (!loadTimes.fromSnapshot)
+	{
+		// This records the times of the steps it's made up of itself
+		LoadBundles(packageHeaders);
+		stepStart = monotonicTimeMicros();
+
+		BuildLocalizedIndex();
+		endStep(loadTimes.buildLocalizedIndex);
+		SaveSnapshot(fingerprint);
+		endStep(loadTimes.saveSnapshot);
+		source = "bundle headers";
+	}
+
+	// We're done loading, print out how long it took and how many files it's tracking (to estimate memory usage)
+	uint64_t end_time = monotonicTimeMicros();
+	loadTimes.total = end_time - start_time;
+
+	// The heap size doesn't include the snapshot, since that's mapped rather than allocated
+	char buff[1024];
+	memset(buff, 0, sizeof(buff));
+	snprintf(buff, sizeof(buff) - 1,
+	         "Finished loading DB info: %zd files in %d ms (from %s), using %zd KiB of heap memory",
+	         filesList.Size(), (int)(end_time - start_time) / 1000, source, HeapSize() / 1024);
+	PD2HOOK_LOG_LOG(buff);
+}
+
+DieselDB::~DieselDB()
+{
+	ReleaseSnapshot();
+}
+
+size_t DieselDB::HeapSize() const
+{
+	return filesList.HeapSize() + files.HeapSize() + localizedFiles.HeapSize() +
+	       bundles.capacity() * sizeof(DieselBundle*);
+}
+
+void DieselDB::LoadBundles(const std::vector<std::string>& packageHeaders)
+{
+	uint64_t start_time = monotonicTimeMicros();
+
+	std::unique_ptr<MappedFile> blb = mapDbFile("assets/bundle_db.blb");
+	MappedReader in(*blb);
 
 	// Skip a pointer - vtable or allocator probably?
-	in.seekg(sizeof(void*), std::ios::cur);
+	in.Skip(sizeof(void*));
 
 	// Build out the LanguageID-to-idstring mappings
-	struct LanguageData
-	{
-		idstring name;
-		int id;
-		int padding; // Probably padding, at least - always zero
-	};
-	static_assert(sizeof(LanguageData) == 16);
 	std::map<int, idstring> languages;
-	for (const LanguageData& lang : loadVector<LanguageData>(in, 0))
+	for (LanguageData lang : loadVector<LanguageData>(in, 0))
 	{
 		languages[lang.id] = lang.name;
 	}
 
 	// Sortmap
-	in.seekg(sizeof(void*) * 2, std::ios::cur);
+	in.Skip(sizeof(void*) * 2);
 
 	// Files
-	struct MiniFile
-	{
-		idstring type;
-		idstring name;
-		int32_t langId;
-		int32_t zero_1;
-		int32_t fileId;
-		int32_t zero_2;
-	};
-	static_assert(sizeof(MiniFile) == 32); // Same on 32 and 64 bit
-	std::vector<MiniFile> miniFiles = loadVector<MiniFile>(in, 0);
-	filesList.resize(miniFiles.size());
+	RecordView<MiniFile> miniFiles = loadVector<MiniFile>(in, 0);
+	filesList.Reset(miniFiles.size());
+	files.Reset(miniFiles.size());
 
-	for (size_t i = 0; i < miniFiles.size(); i++)
+	idstring* names = filesList.names.Writable();
+	idstring* types = filesList.types.Writable();
+	uint16_t* fileLanguages = filesList.languages.Writable();
+	uint32_t* next = filesList.next.Writable();
+
+	for (MiniFile mini : miniFiles)
 	{
-		MiniFile& mini = miniFiles[i];
 		// printf("File: %016llx.%016llx\n", mini.name, mini.type);
 		assert(mini.zero_1 == 0);
 		assert(mini.zero_2 == 0);
 
 		// Since the file IDs form a sequence of 1 upto the file count (though not in
 		// order), we can use those as indexes into our file list.
-		DslFile& fi = filesList.at(mini.fileId - 1);
+		uint32_t fi = fileIndex(mini.fileId, filesList.Size());
 
-		fi.name = mini.name;
-		fi.type = mini.type;
-		fi.fileId = mini.fileId;
+		names[fi] = mini.name;
+		types[fi] = mini.type;
 
 		// Look up the language idstring, if applicable
-		fi.rawLangId = mini.langId;
 		if (mini.langId == 0)
-			fi.langId = 0;
+			fileLanguages[fi] = 0;
 		else if (languages.count(mini.langId))
-			fi.langId = languages[mini.langId];
-		else
-			fi.langId = 0x11df684c9591b7e0; // 'unknown' - is in the hashlist, so you'll be able to find it
+			fileLanguages[fi] = filesList.AddLanguage(mini.langId, languages[mini.langId]);
+		else // 'unknown' - is in the hashlist, so you'll be able to find it
+			fileLanguages[fi] = filesList.AddLanguage(mini.langId, 0x11df684c9591b7e0);
 
 		// If it's a repeated file, the language must be different
-		const auto& prev = files.find(fi.Key());
-		if (prev != files.end())
+		FileIndex::Slot& slot = files.Locate(mini.name, mini.type);
+		if (slot.file != FileIndex::EMPTY)
 		{
-			assert(prev->second->langId != fi.langId);
-			fi.next = prev->second;
+			assert(filesList.languageTable[fileLanguages[slot.file]].name !=
+			       filesList.languageTable[fileLanguages[fi]].name);
+			next[fi] = slot.file;
 		}
 
-		files[fi.Key()] = &fi;
+		slot.name = mini.name;
+		slot.type = mini.type;
+		slot.file = fi;
 	}
 
 	// printf("File count: %ld\n", files.size());
 
-	// Load each of the bundle headers
+	// We're done with the main DB file now, so unmap it
+	blb.reset();
+
+	uint64_t blb_time = monotonicTimeMicros();
+	loadTimes.parseDatabase = blb_time - start_time;
+
+	// Load each of the bundle headers. The headers are independent of each other, so they're parsed
+	// concurrently into separate lists of entries. Those are then applied to the file list in the same order
+	// as a sequential load would, so if a file appears in several headers the last one still wins.
+	std::vector<HeaderTask> tasks(packageHeaders.size() + 1);
+	for (size_t i = 0; i < packageHeaders.size(); i++)
+	{
+		const std::string& headerPath = packageHeaders[i];
+
+		// Find the headerPath to the data file - chop out the '_h' bit
+		std::string dataPath = headerPath;
+		dataPath.erase(dataPath.end() - 9, dataPath.end() - 7);
+
+		tasks[i].bundles.push_back(DieselBundle{dataPath, headerPath});
+		tasks[i].run = [count{filesList.Size()}](HeaderTask& task) {
+			loadPackageHeader(task.bundles.front().headerPath, count, task.entries);
+		};
+	}
+
+	tasks.back().run = [count{filesList.Size()}](HeaderTask& task) {
+		loadBundleHeader("assets/all_h.bundle", count, task.entries, task.bundles);
+	};
+
+	runHeaderTasks(tasks);
+
+	uint64_t headers_time = monotonicTimeMicros();
+	loadTimes.parseHeaders = headers_time - blb_time;
+
+	uint32_t* fileBundles = filesList.bundles.Writable();
+	uint32_t* offsets = filesList.offsets.Writable();
+	uint32_t* lengths = filesList.lengths.Writable();
+
+	for (HeaderTask& task : tasks)
+	{
+		// Rethrow any errors in the same order they'd have occurred in if we were loading sequentially
+		if (task.error)
+			std::rethrow_exception(task.error);
+
+		// Move the bundles into the DB's bundle table, and work out where they ended up
+		std::vector<uint32_t> bundleIds;
+		for (const DieselBundle& bundle : task.bundles)
+		{
+			bundleIds.push_back(AddBundle(bundle.path, bundle.headerPath));
+		}
+
+		for (const HeaderEntry& entry : task.entries)
+		{
+			fileBundles[entry.file] = bundleIds.at(entry.bundle);
+			offsets[entry.file] = entry.offset;
+			if (entry.setLength)
+				lengths[entry.file] = entry.length;
+		}
+	}
+
+	loadTimes.applyHeaders = monotonicTimeMicros() - headers_time;
+}
+
+void DieselDB::BuildLocalizedIndex()
+{
+	// Only the files that come in several languages go in here, everything else can be found through the main index
+	std::vector<bool> localized(filesList.Size());
+	size_t count = 0;
+	for (uint32_t i = 0; i < filesList.Size(); i++)
+	{
+		uint32_t next = filesList.next[i];
+		if (next == DslFileTable::NONE)
+			continue;
+
+		for (uint32_t fi : {i, next})
+		{
+			if (!localized[fi])
+				count++;
+			localized[fi] = true;
+		}
+	}
+
+	localizedFiles.Reset(count);
+	for (uint32_t i = 0; i < filesList.Size(); i++)
+	{
+		if (!localized[i])
+			continue;
+
+		// Files are keyed on the first language with the same name, so it doesn't matter which raw ID they used
+		uint16_t language = filesList.FindLanguage(filesList.LanguageName(i)).value_or(0);
+
+		FileIndex::Slot& slot = localizedFiles.Locate(filesList.names[i], filesList.types[i], language);
+		slot.name = filesList.names[i];
+		slot.type = filesList.types[i];
+		slot.file = i;
+		slot.language = language;
+	}
+}
+
+// Every bundle any version of the DB has used. DslFile points to these, so they're never freed - that way a DslFile
+// can still be read from after the DB is reloaded. There's only a few hundred bundles, so this barely grows.
+static std::mutex bundle_registry_mutex;
+static std::deque<DieselBundle> bundle_registry;
+
+DieselBundle* DieselDB::InternBundle(const std::string& path, const std::string& headerPath)
+{
+	std::lock_guard guard(bundle_registry_mutex);
+
+	// There's only a few hundred bundles, so a linear search is fine
+	for (DieselBundle& bundle : bundle_registry)
+	{
+		if (bundle.path == path)
+			return &bundle;
+	}
+
+	bundle_registry.push_back(DieselBundle{path, headerPath});
+	return &bundle_registry.back();
+}
+
+uint32_t DieselDB::AddBundle(const std::string& path, const std::string& headerPath)
+{
+	DieselBundle* bundle = InternBundle(path, headerPath);
+	for (size_t i = 0; i < bundles.size(); i++)
+	{
+		if (bundles[i] == bundle)
+			return (uint32_t)i;
+	}
+
+	bundles.push_back(bundle);
+	return (uint32_t)(bundles.size() - 1);
+}
+
+static void runHeaderTasks(std::vector<HeaderTask>& tasks)
+{
+	// Reading the headers is mostly waiting on IO, so use a few more threads than just the number of cores, but
+	// bound it so we don't go starting hundreds of threads on a big machine.
+	size_t threadCount = std::thread::hardware_concurrency();
+	threadCount = std::clamp<size_t>(threadCount, 1, MAX_HEADER_THREADS);
+	threadCount = std::min(threadCount, tasks.size());
+
+	std::atomic<size_t> nextTask{0};
+	auto worker = [&tasks, &nextTask]() {
+		for (size_t i = nextTask++; i < tasks.size(); i = nextTask++)
+		{
+			try
+			{
+				tasks[i].run(tasks[i]);
+			}
+			catch (...)
+			{
+				tasks[i].error = std::current_exception();
+			}
+		}
+	};
+
+	// This thread does it's share of the work too
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+static std::vector<std::string> listPackageHeaders()
+{
+	std::vector<std::string> headers;
+
 	std::string suffix = "_h.bundle";
 	for (const std::string& name : pd2hook::Util::GetDirectoryContents("assets"))
 	{
@@ -217,136 +953,294 @@ DieselDB::DieselDB()
 			continue;
 		}
 
-		std::string headerPath = "assets/" + name;
-
-		// Find the headerPath to the data file - chop out the '_h' bit
-		std::string dataPath = headerPath;
-		dataPath.erase(dataPath.end() - 9, dataPath.end() - 7);
-
-		// Memory leak, not an issue since it's a small amount and the DB doesn't get unloaded anyway
-		auto* bundle = new DieselBundle();
-		bundle->headerPath = headerPath;
-		bundle->path = dataPath;
-		loadPackageHeader(bundle, filesList);
+		headers.push_back("assets/" + name);
 	}
 
-	loadBundleHeader("assets/all_h.bundle", filesList);
-
-	// We're done loading, print out how long it took and how many files it's tracking (to estimate memory usage)
-	uint64_t end_time = monotonicTimeMicros();
+	return headers;
+}
 
-	char buff[1024];
-	memset(buff, 0, sizeof(buff));
-	snprintf(buff, sizeof(buff) - 1, "Finished loading DB info: %zd files in %d ms", filesList.size(),
-	         (int)(end_time - start_time) / 1000);
-	PD2HOOK_LOG_LOG(buff);
+static uint32_t fileIndex(int64_t fileId, size_t fileCount)
+{
+	// File IDs start at one
+	if (fileId < 1 || (uint64_t)fileId > fileCount)
+		PD2HOOK_SIMPLE_THROW_MSG("Invalid file ID " + std::to_string(fileId) + " in bundle header");
+	return (uint32_t)(fileId - 1);
 }
 
-static void loadPackageHeader(DieselBundle* bundle, FileList files)
+static void loadPackageHeader(const std::string& filename, size_t fileCount, std::vector<HeaderEntry>& entries)
 {
-	std::ifstream in;
-	in.exceptions(std::ios::failbit | std::ios::badbit);
-	in.open(bundle->headerPath, std::ios::binary);
+	std::unique_ptr<MappedFile> header = mapDbFile(filename);
+	MappedReader in(*header);
 
 	// Skip an int, the length of the header
-	in.seekg(4, std::ios::cur);
+	in.Skip(4);
 
 	// Files
-	struct FilePos
-	{
-		int32_t fileId;
-		int32_t offset;
-	};
-	static_assert(sizeof(FilePos) == 8); // Same on 32 and 64 bit
-	std::vector<FilePos> positions = loadVector<FilePos>(in, 4);
+	RecordView<FilePos> positions = loadVector<FilePos>(in, 4);
+	entries.reserve(positions.size());
 
-	DslFile* prev = nullptr;
-	for (const FilePos& fp : positions)
+	HeaderEntry* prev = nullptr;
+	for (FilePos fp : positions)
 	{
-		DslFile* fi = &files.at(fp.fileId - 1);
+		HeaderEntry& entry = entries.emplace_back();
+		entry.bundle = 0;
+		entry.file = fileIndex(fp.fileId, fileCount);
+		entry.offset = fp.offset;
+		entry.length = ~0u;
+		entry.setLength = false;
 
-		fi->bundle = bundle;
-		fi->offset = fp.offset;
 		if (prev != nullptr)
 		{
-			prev->length = fi->offset - prev->offset;
+			prev->length = entry.offset - prev->offset;
+			prev->setLength = true;
 		}
 
-		prev = fi;
+		prev = &entry;
 	}
 
 	// TODO set a length for the last file
 }
 
-static void loadBundleHeader(std::string filename, FileList files)
+static void loadBundleHeader(const std::string& filename, size_t fileCount, std::vector<HeaderEntry>& entries,
+                             std::vector<DieselBundle>& bundles)
 {
-	std::ifstream in;
-	in.exceptions(std::ios::failbit | std::ios::badbit);
-	in.open(filename, std::ios::binary);
+	std::unique_ptr<MappedFile> header = mapDbFile(filename);
+	MappedReader in(*header);
 
 	// Skip an int, the length of the header
-	in.seekg(4, std::ios::cur);
-
-	struct BundleInfo
-	{
-		intptr_t id;
-		intptr_t zero;
-		dsl_Vector vec;
-		intptr_t one;
-	};
-#if defined(__x86_64__)
-	static_assert(sizeof(BundleInfo) == 48);
-#else
-	static_assert(sizeof(BundleInfo) == 28);
-#endif
-
-	struct ItemInfo
-	{
-		uint32_t fileId;
-		uint32_t offset;
-		uint32_t length;
-	};
-	static_assert(sizeof(ItemInfo) == 12); // True on 32/64 bit
+	in.Skip(4);
 
+	// Find all the bundles' item lists first, so the entries only need to be allocated once
+	std::vector<RecordView<ItemInfo>> bundleItems;
+	size_t itemCount = 0;
+	uint32_t firstBundle = (uint32_t)bundles.size();
 	for (BundleInfo bundle : loadVector<BundleInfo>(in, 4))
 	{
 		assert(bundle.zero == 0);
 		assert(bundle.one == 1);
 
-		// Memory leak, not an issue since it's a small amount and the DB doesn't get unloaded anyway
-		DieselBundle* dieselBundle = new DieselBundle();
-		dieselBundle->headerPath = filename;
-		dieselBundle->path = "assets/all_" + std::to_string(bundle.id) + ".bundle";
+		bundles.push_back(DieselBundle{"assets/all_" + std::to_string(bundle.id) + ".bundle", filename});
+		bundleItems.push_back(loadVector<ItemInfo>(in, 4, bundle.vec));
+		itemCount += bundleItems.back().size();
+	}
 
-		for (ItemInfo item : loadVector<ItemInfo>(in, 4, bundle.vec))
+	entries.reserve(entries.size() + itemCount);
+	for (uint32_t i = 0; i < bundleItems.size(); i++)
+	{
+		uint32_t bundleId = firstBundle + i;
+		for (ItemInfo item : bundleItems[i])
 		{
-			DslFile* fi = &files.at(item.fileId - 1);
-			fi->bundle = dieselBundle;
-			fi->offset = item.offset;
-			fi->length = item.length;
+			HeaderEntry& entry = entries.emplace_back();
+			entry.bundle = bundleId;
+			entry.file = fileIndex(item.fileId, fileCount);
+			entry.offset = item.offset;
+			entry.length = item.length;
+			entry.setLength = true;
 		}
 	}
 }
 
-DslFile* DieselDB::Find(idstring name, idstring ext)
+std::optional<DslFile> DieselDB::Find(idstring name, idstring ext)
 {
-	auto res = files.find(std::pair<idstring, idstring>(name, ext));
+	uint32_t res = files.Find(name, ext);
 
 	// Not found?
-	if (res == files.end())
+	if (res >= filesList.Size())
 	{
-		return nullptr;
+		return std::nullopt;
+	}
+
+	return GetFile(res);
+}
+
+std::optional<DslFile> DieselDB::Next(const DslFile& file)
+{
+	if (file.next >= filesList.Size())
+		return std::nullopt;
+
+	return GetFile(file.next);
+}
+
+std::optional<DslFile> DieselDB::FindLocalized(idstring name, idstring ext, idstring language, bool fallback)
+{
+	static const idstring english = blt::idstring_hash("english");
+	const idstring candidates[] = {language, 0, english};
+	size_t candidateCount = fallback ? 3 : 1;
+
+	uint32_t head = files.Find(name, ext);
+	if (head >= filesList.Size())
+		return std::nullopt;
+
+	// Most files only come in a single version, in which case there's no need to look any further
+	if (filesList.next[head] >= filesList.Size())
+	{
+		idstring fileLanguage = filesList.LanguageName(head);
+		for (size_t i = 0; i < candidateCount; i++)
+		{
+			if (fileLanguage == candidates[i])
+				return GetFile(head);
+		}
+
+		return std::nullopt;
+	}
+
+	for (size_t i = 0; i < candidateCount; i++)
+	{
+		std::optional<uint16_t> languageIndex = filesList.FindLanguage(candidates[i]);
+		if (!languageIndex)
+			continue;
+
+		uint32_t res = localizedFiles.Find(name, ext, *languageIndex);
+		if (res < filesList.Size())
+			return GetFile(res);
+	}
+
+	return std::nullopt;
+}
+
+DslFile DieselDB::GetFile(uint32_t index)
+{
+	DslFile file = filesList.Get(index, bundles);
+	file.generation = generation;
+	return file;
+}
+
+std::optional<uint32_t> DieselDB::FindBundle(const std::string& name) const
+{
+	for (size_t i = 0; i < bundles.size(); i++)
+	{
+		const std::string& path = bundles[i]->path;
+		if (path == name)
+			return (uint32_t)i;
+
+		size_t start = path.find_last_of("/\\");
+		start = start == std::string::npos ? 0 : start + 1;
+		size_t end = path.find('.', start);
+		if (end == std::string::npos)
+			end = path.size();
+
+		if (path.compare(start, end - start, name) == 0)
+			return (uint32_t)i;
 	}
 
-	return res->second;
+	return std::nullopt;
+}
+
+const std::vector<uint32_t>& DieselDB::FilesByType()
+{
+	std::call_once(sortedViewsFlag, [this]() { BuildSortedViews(); });
+	return filesByType;
+}
+
+const std::vector<uint32_t>& DieselDB::FilesByBundle()
+{
+	std::call_once(sortedViewsFlag, [this]() { BuildSortedViews(); });
+	return filesByBundle;
+}
+
+void DieselDB::BuildSortedViews()
+{
+	std::vector<uint32_t> order(filesList.Size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = (uint32_t)i;
+
+	// Sort by only looking at the one column, and keep files with the same key in index order so
+	// queries give the same results whichever view they use.
+	const idstring* types = filesList.types.Data();
+	filesByType = order;
+	std::stable_sort(filesByType.begin(), filesByType.end(),
+	                 [types](uint32_t a, uint32_t b) { return types[a] < types[b]; });
+
+	const uint32_t* fileBundles = filesList.bundles.Data();
+	filesByBundle = std::move(order);
+	std::stable_sort(filesByBundle.begin(), filesByBundle.end(),
+	                 [fileBundles](uint32_t a, uint32_t b) { return fileBundles[a] < fileBundles[b]; });
+}
+
+std::pair<uint32_t, uint32_t> DieselDB::FileRangeByType(idstring type)
+{
+	const std::vector<uint32_t>& view = FilesByType();
+	const idstring* types = filesList.types.Data();
+
+	auto begin = std::partition_point(view.begin(), view.end(), [&](uint32_t i) { return types[i] < type; });
+	auto end = std::partition_point(begin, view.end(), [&](uint32_t i) { return types[i] == type; });
+	return {(uint32_t)(begin - view.begin()), (uint32_t)(end - view.begin())};
+}
+
+std::pair<uint32_t, uint32_t> DieselDB::FileRangeByBundle(uint32_t bundle)
+{
+	const std::vector<uint32_t>& view = FilesByBundle();
+	const uint32_t* fileBundles = filesList.bundles.Data();
+
+	auto begin =
+	    std::partition_point(view.begin(), view.end(), [&](uint32_t i) { return fileBundles[i] < bundle; });
+	auto end = std::partition_point(begin, view.end(), [&](uint32_t i) { return fileBundles[i] == bundle; });
+	return {(uint32_t)(begin - view.begin()), (uint32_t)(end - view.begin())};
+}
+
+BLTAbstractDataStore* DieselDB::Open(DieselBundle* bundle, ReadMode mode)
+{
+	// The data store is reference counted by dsl::Archive, which deletes it when it's done. So rather than
+	// caching the data stores themselves, hand out a new one each time that shares the bundle's open file.
+	if (mode == ReadMode::Mapped)
+	{
+		std::shared_ptr<const MappedFile> mapping = BundleHandlePool::Instance().GetMapping(bundle->path);
+		if (!mapping)
+			return nullptr;
+
+		return new BLTMappedDataStore(std::move(mapping));
+	}
+
+	std::shared_ptr<BLTSharedFile> file = BundleHandlePool::Instance().Get(bundle->path);
+	if (!file)
+		return nullptr;
+
+	if (mode == ReadMode::Buffered)
+		return new BLTBufferedDataStore(new BLTSharedFileDataStore(std::move(file)));
+
+	return new BLTSharedFileDataStore(std::move(file));
+}
+
+BLTAbstractDataStore* DieselDB::OpenFile(const std::string& path, ReadMode mode)
+{
+	std::shared_ptr<BLTSharedFile> file = BLTSharedFile::Open(path);
+	if (!file)
+		return nullptr;
+
+	// Compressed files are always read through their index, whatever mode was asked for
+	if (BLTCompressedDataStore::IsCompressed(*file))
+		return BLTCompressedDataStore::Open(std::move(file), path);
+
+	if (mode == ReadMode::Mapped)
+		return BLTMappedDataStore::Open(path);
+
+	if (mode == ReadMode::Buffered)
+		return new BLTBufferedDataStore(new BLTSharedFileDataStore(std::move(file)));
+
+	return new BLTSharedFileDataStore(std::move(file));
+}
+
+const char* blt::db::ReadModeName(ReadMode mode)
+{
+	switch (mode)
+	{
+	case ReadMode::Mapped:
+		return "mapped";
+	case ReadMode::Buffered:
+		return "buffered";
+	case ReadMode::Default:
+	default:
+		return "default";
+	}
 }
 
-BLTAbstractDataStore* DieselDB::Open(DieselBundle* bundle)
+std::optional<ReadMode> blt::db::ParseReadMode(const std::string& name)
 {
-	// Ideally we'd cache these to avoid opening files all the time, but this is
-	// pretty much what the Linux version of PD2 seems to do internally. The
-	// problem here is that the data store is reference counted by dsl::Archive, so
-	// caching it will be somewhat difficult.
-	BLTFileDataStore* fds = BLTFileDataStore::Open(bundle->path);
-	return fds;
+	if (name == "default")
+		return ReadMode::Default;
+	if (name == "mapped")
+		return ReadMode::Mapped;
+	if (name == "buffered")
+		return ReadMode::Buffered;
+	return std::nullopt;
 }
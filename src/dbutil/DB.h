@@ -1,15 +1,40 @@
 #pragma once
 
 #include "Datastore.h"
+#include "MappedFile.h"
 #include "platform.h"
 
 #include <istream>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <vector>
 
+#include <stdint.h>
+
 namespace blt::db
 {
 
+	/** How the datastores handed to the engine read their files, see DieselDB::Open. */
+	enum class ReadMode
+	{
+		// Read through a file descriptor, with a system call for each read
+		Default,
+
+		// Read from a memory mapping of the file
+		Mapped,
+
+		// Read through a file descriptor, but serve small reads from a window read ahead of them
+		Buffered,
+	};
+
+	/** Get the name of a read mode, as used by Lua and Wren. */
+	const char* ReadModeName(ReadMode mode);
+
+	/** Find a read mode by it's name, as returned by ReadModeName. */
+	std::optional<ReadMode> ParseReadMode(const std::string& name);
+
 	struct DieselBundle
 	{
 	  public:
@@ -17,9 +42,18 @@ namespace blt::db
 		std::string headerPath;
 	};
 
+	/**
+	 * A single asset in the DB.
+	 *
+	 * The DB doesn't store these directly - see DslFileTable - so this is a copy of an asset's entry, as
+	 * returned by DieselDB::Find. The bundle it points to is never freed, so this can be kept around even if
+	 * the DB is reloaded - though if the bundles were changed, it'll still refer to where the asset used to be.
+	 */
 	struct DslFile
 	{
 	  public:
+		static constexpr uint32_t NONE = ~0u;
+
 		idstring name;
 		idstring type;
 		int fileId;
@@ -27,10 +61,15 @@ namespace blt::db
 		idstring langId;
 
 		/**
-		 * If there are multiple of this kind of asset, but in different languages, then this
-		 * points to another file with the same name/type but a different language.
+		 * If there are multiple of this kind of asset, but in different languages, then this is the
+		 * index of another file with the same name/type but a different language, or NONE. Use
+		 * DieselDB::Next to get it.
 		 */
-		DslFile* next = nullptr;
+		uint32_t next = NONE;
+
+		// The generation of the DB this file came from (see DieselDB::Generation), since the file IDs are
+		// assigned afresh each time the DB is reloaded
+		uint64_t generation = 0;
 
 		// These are used for reading, and are picked up from the bundle headers
 		DieselBundle* bundle = nullptr;
@@ -53,6 +92,217 @@ namespace blt::db
 		}
 
 		[[nodiscard]] std::vector<uint8_t> ReadContents(std::istream& fi) const;
+
+		// Direct reads smaller than this go through the OS's file cache anyway, since skipping it costs more
+		// than it saves for small reads
+		static const uint64_t DIRECT_READ_THRESHOLD = 4 * 1024 * 1024;
+
+		/**
+		 * Read part of this asset, starting the given number of bytes into it. The length is clamped to the end
+		 * of the asset. This reads directly from the bundle at the right position, without going through a stream.
+		 *
+		 * If direct is set, large reads skip the OS's file cache (using O_DIRECT, or FILE_FLAG_NO_BUFFERING on
+		 * Windows), so reading a huge asset once doesn't push the game's own files out of it. This falls back to
+		 * a normal read if the filesystem doesn't support it.
+		 *
+		 * Throws if the bundle can't be read, or if the start lies past the end of the asset.
+		 */
+		[[nodiscard]] std::vector<uint8_t> ReadRange(uint64_t start, uint64_t count, bool direct = false) const;
+	};
+
+	/**
+	 * An array of values making up one column of one of the DB's tables.
+	 *
+	 * While the DB is being built the values are stored in a vector, but a column may instead be attached to
+	 * an array stored elsewhere, such as in a memory-mapped snapshot.
+	 */
+	template <typename T> class DBColumn
+	{
+	  public:
+		/** Replace the contents of this column with count copies of value, and return them for writing. */
+		T* Reset(size_t count, const T& value)
+		{
+			storage.assign(count, value);
+			ptr = storage.data();
+			return storage.data();
+		}
+
+		/** Use an array stored elsewhere. This column must not outlive it. */
+		void Attach(const T* data)
+		{
+			storage.clear();
+			storage.shrink_to_fit();
+			ptr = data;
+		}
+
+		/** Get the values for writing - this is only valid if the column isn't attached to an external array. */
+		T* Writable()
+		{
+			return storage.data();
+		}
+
+		[[nodiscard]] const T* Data() const
+		{
+			return ptr;
+		}
+
+		const T& operator[](size_t i) const
+		{
+			return ptr[i];
+		}
+
+		/** The number of bytes of heap memory used by this column, which is zero for an attached column. */
+		[[nodiscard]] size_t HeapSize() const
+		{
+			return storage.capacity() * sizeof(T);
+		}
+
+	  private:
+		std::vector<T> storage;
+		const T* ptr = nullptr;
+	};
+
+	/**
+	 * The DB's list of files, stored as a structure-of-arrays to keep it as small as possible - there are
+	 * hundreds of thousands of assets in the game, so every byte here counts.
+	 *
+	 * Each file is identified by it's index in the table, which is it's file ID minus one. Links to other
+	 * tables are stored as 32-bit indexes rather than pointers, so the whole thing can be written straight
+	 * into the snapshot and used from there.
+	 */
+	class DslFileTable
+	{
+	  public:
+		static constexpr uint32_t NONE = DslFile::NONE;
+
+		// A language the assets may be in - there's only a handful of these, so the files just store
+		// the index of the one they're in.
+		struct Language
+		{
+			int32_t rawId;
+			int32_t padding;
+			idstring name;
+		};
+
+		/** Clear the table, and size it to hold count files. */
+		void Reset(size_t count);
+
+		/**
+		 * Find the index into the language table for the given raw language ID, adding a new language
+		 * if required.
+		 */
+		uint16_t AddLanguage(int32_t rawId, idstring name);
+
+		/**
+		 * Find the first entry in the language table with the given name. Several raw language IDs may map to
+		 * the same name, in which case this is the one used in the localized file index.
+		 */
+		[[nodiscard]] std::optional<uint16_t> FindLanguage(idstring name) const;
+
+		/** Get the name of the language the file at the given index is in, or zero if it has no language. */
+		[[nodiscard]] idstring LanguageName(uint32_t index) const;
+
+		[[nodiscard]] size_t Size() const
+		{
+			return count;
+		}
+
+		/** The number of bytes of heap memory used by this table. */
+		[[nodiscard]] size_t HeapSize() const;
+
+		/** Build a copy of the file at the given index. The bundles must be the DB's bundle table. */
+		[[nodiscard]] DslFile Get(uint32_t index, const std::vector<DieselBundle*>& bundles) const;
+
+		size_t count = 0;
+		DBColumn<idstring> names;
+		DBColumn<idstring> types;
+		DBColumn<uint16_t> languages; // Index into the language table
+		DBColumn<uint32_t> next;      // Index of the next language version of this file, or NONE
+		DBColumn<uint32_t> bundles;   // Index into the DB's bundle table, or NONE
+		DBColumn<uint32_t> offsets;
+		DBColumn<uint32_t> lengths;
+
+		std::vector<Language> languageTable;
+	};
+
+	/**
+	 * An open-addressing hash table mapping (name, type) pairs to indexes in the DB's file list.
+	 *
+	 * Since idstrings are already well-mixed 64-bit hashes, they're used directly to pick the starting
+	 * slot and collisions are resolved by linear probing. The keys are stored inline in the slots, so a
+	 * lookup usually touches a single cache line - much better than walking a std::map with hundreds of
+	 * thousands of nodes scattered around the heap.
+	 *
+	 * Entries may optionally also be keyed on a language (an index into the file table's language table),
+	 * which is used for the DB's localized file index. The main index leaves it as zero.
+	 */
+	class FileIndex
+	{
+	  public:
+		static const uint32_t EMPTY = ~0u;
+
+		struct Slot
+		{
+			idstring name;
+			idstring type;
+			uint32_t file;
+			uint16_t language;
+			uint16_t padding;
+		};
+
+		/** Clear the index, and size it such that it can hold the given number of entries without rehashing. */
+		void Reset(size_t capacity);
+
+		/**
+		 * Use a table of slots stored elsewhere, such as in a memory-mapped snapshot. The slots must outlive the
+		 * index, and the count must be a power of two. Locate may not be used on an attached index.
+		 */
+		void Attach(const Slot* data, size_t count);
+
+		[[nodiscard]] const Slot* Data() const
+		{
+			return slots.Data();
+		}
+
+		[[nodiscard]] size_t HeapSize() const
+		{
+			return slots.HeapSize();
+		}
+
+		[[nodiscard]] size_t Size() const
+		{
+			return mask + 1;
+		}
+
+		/** Find the slot holding the given key, or the empty slot it should be inserted into. */
+		Slot& Locate(idstring name, idstring type, uint16_t language = 0);
+
+		/** Find the index of the file with the given name and type, or EMPTY if there is no such file. */
+		[[nodiscard]] uint32_t Find(idstring name, idstring type, uint16_t language = 0) const
+		{
+			// A table built here always has an empty slot, but one loaded from a corrupt snapshot might not, so
+			// don't go round more than once
+			size_t i = Start(name, type, language);
+			for (size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+			{
+				const Slot& slot = slots[i];
+				if (slot.file == EMPTY)
+					return EMPTY;
+				if (slot.name == name && slot.type == type && slot.language == language)
+					return slot.file;
+			}
+			return EMPTY;
+		}
+
+	  private:
+		[[nodiscard]] size_t Start(idstring name, idstring type, uint16_t language) const
+		{
+			// Spread the language out, since it's only a small number and the name is used as-is
+			return (size_t)(name ^ type ^ (language * 0x9e3779b97f4a7c15ull)) & mask;
+		}
+
+		DBColumn<Slot> slots;
+		size_t mask = 0;
 	};
 
 	class DieselDB
@@ -63,16 +313,185 @@ namespace blt::db
 	  public:
 		DieselDB(const DieselDB&) = delete;
 		DieselDB& operator=(const DieselDB&) = delete;
+		~DieselDB();
 
-		DslFile* Find(idstring name, idstring ext);
+		std::optional<DslFile> Find(idstring name, idstring ext);
 
-		static DieselDB* Instance();
+		/** Get the next language version of a file, if there is one. */
+		std::optional<DslFile> Next(const DslFile& file);
+
+		/**
+		 * Find a file in a given language. If fallback is set and there's no version of the file in that language,
+		 * the version with no language is used, followed by the English version.
+		 *
+		 * This goes through a separate index of the files which exist in several languages, so it's still only
+		 * a single probe rather than walking the list of each file's language versions.
+		 */
+		std::optional<DslFile> FindLocalized(idstring name, idstring ext, idstring language, bool fallback = true);
+
+		/**
+		 * Get the current version of the DB, loading it if this is the first call.
+		 *
+		 * If the game's bundles change, the DB is rebuilt in the background and replaces this one for future
+		 * calls (see Reload). The version returned here stays valid for as long as you hold on to it, but
+		 * don't keep it for any longer than you need to.
+		 */
+		static std::shared_ptr<DieselDB> Instance();
+
+		/** Get the current version of the DB like Instance, or null if it hasn't been loaded yet. */
+		static std::shared_ptr<DieselDB> InstanceIfLoaded();
+
+		/**
+		 * A fingerprint of the bundle headers currently on disk, which only changes if they do. This doesn't
+		 * need the DB to be loaded, and is the same value GetFingerprint returns for a DB loaded from them.
+		 */
+		static uint64_t CurrentFingerprint();
+
+		/**
+		 * Rebuild the DB if the bundle headers on disk have changed since the current version was loaded, and
+		 * publish the new version to future calls to Instance. Anything still using the old version carries on
+		 * using it, and it's freed once the last of them is done. Returns true if the DB was replaced.
+		 *
+		 * This may take a while, so it should be run in the background. It does nothing if the DB hasn't been
+		 * loaded yet.
+		 */
+		static bool Reload();
+
+		/**
+		 * How long each step of loading the DB took, in microseconds. Steps that weren't needed - such as
+		 * parsing the bundle headers, if the DB was loaded from a snapshot - are left as zero.
+		 */
+		struct LoadTimes
+		{
+			uint64_t listHeaders = 0;
+			uint64_t fingerprint = 0;
+			uint64_t loadSnapshot = 0;
+			uint64_t parseDatabase = 0; // bundle_db.blb, which lists all the files
+			uint64_t parseHeaders = 0;
+			uint64_t applyHeaders = 0;
+			uint64_t buildLocalizedIndex = 0;
+			uint64_t saveSnapshot = 0;
+			uint64_t total = 0;
+			bool fromSnapshot = false;
+		};
+
+		[[nodiscard]] const LoadTimes& GetLoadTimes() const
+		{
+			return loadTimes;
+		}
+
+		/** The number of bytes of heap memory used by the DB's tables, not including the snapshot. */
+		[[nodiscard]] size_t HeapSize() const;
+
+		[[nodiscard]] size_t BundleCount() const
+		{
+			return bundles.size();
+		}
 
-		BLTAbstractDataStore* Open(DieselBundle* bundle);
+		/** Delete the cached copy of the DB (see DBSnapshot.cpp), so the next load parses the bundle headers again. */
+		static void DeleteSnapshot();
+
+		/** The fingerprint of the bundle headers this version of the DB was loaded from, see CurrentFingerprint. */
+		[[nodiscard]] uint64_t GetFingerprint() const
+		{
+			return fingerprint;
+		}
+
+		/** A number identifying this version of the DB, which goes up each time it's reloaded. */
+		[[nodiscard]] uint64_t Generation() const
+		{
+			return generation;
+		}
+
+		/**
+		 * Create a datastore for reading from a bundle, or null if it can't be opened. These share the bundle's
+		 * file (or mapping) through BundleHandlePool, so this doesn't normally need to open it again.
+		 */
+		BLTAbstractDataStore* Open(DieselBundle* bundle, ReadMode mode = ReadMode::Default);
+
+		/**
+		 * Create a datastore for reading from a file outside the bundles, such as one of a mod's assets, or null
+		 * if it can't be opened. Unlike bundles these aren't shared, since mods may change them while the game
+		 * is running.
+		 *
+		 * Files compressed by sblt_dbtool's compress command are recognised by their header, and decompressed
+		 * as they're read.
+		 */
+		static BLTAbstractDataStore* OpenFile(const std::string& path, ReadMode mode = ReadMode::Default);
+
+		/** The number of files in the DB. Each file is identified by an index between zero and this. */
+		[[nodiscard]] size_t FileCount() const
+		{
+			return filesList.Size();
+		}
+
+		[[nodiscard]] const DslFileTable& Files() const
+		{
+			return filesList;
+		}
+
+		/** Build a copy of the file at the given index. */
+		DslFile GetFile(uint32_t index);
+
+		/**
+		 * Find the index of a bundle, either by it's full path or by it's name - the filename without the
+		 * directory or extension, eg "all_5" or "0a1b2c3d4e5f6789".
+		 */
+		[[nodiscard]] std::optional<uint32_t> FindBundle(const std::string& name) const;
+
+		/**
+		 * The indexes of all the files, sorted by type or by bundle respectively. Files of the same type (or in
+		 * the same bundle) are kept in index order, and can be found with FileRangeByType/FileRangeByBundle.
+		 *
+		 * These are built the first time they're used, since most of the time nothing needs them.
+		 */
+		const std::vector<uint32_t>& FilesByType();
+		const std::vector<uint32_t>& FilesByBundle();
+
+		/** Find the [begin, end) range of positions in FilesByType holding the files of the given type. */
+		std::pair<uint32_t, uint32_t> FileRangeByType(idstring type);
+
+		/** Find the [begin, end) range of positions in FilesByBundle holding the files in the given bundle. */
+		std::pair<uint32_t, uint32_t> FileRangeByBundle(uint32_t bundle);
 
 	  private:
-		std::vector<DslFile> filesList;
-		std::map<std::pair<idstring, idstring>, DslFile*> files;
+		/** Build the file list and index by parsing bundle_db.blb and all the bundle headers. */
+		void LoadBundles(const std::vector<std::string>& packageHeaders);
+
+		// See DBSnapshot.cpp
+		static uint64_t Fingerprint(const std::vector<std::string>& packageHeaders);
+		bool LoadSnapshot(uint64_t fingerprint);
+		void SaveSnapshot(uint64_t fingerprint) const;
+		void ReleaseSnapshot();
+
+		/** Build the index of the files which are available in several languages, see FindLocalized. */
+		void BuildLocalizedIndex();
+
+		/** Add a bundle to the bundle table, or find the existing bundle with the same path. */
+		uint32_t AddBundle(const std::string& path, const std::string& headerPath);
+
+		/** Find or create the process-wide bundle object with the given path, which is never freed. */
+		static DieselBundle* InternBundle(const std::string& path, const std::string& headerPath);
+
+		/** Build filesByType and filesByBundle, see FilesByType. */
+		void BuildSortedViews();
+
+		uint64_t generation = 0;
+		uint64_t fingerprint = 0;
+		LoadTimes loadTimes;
+
+		DslFileTable filesList;
+		std::vector<DieselBundle*> bundles; // See InternBundle
+		FileIndex files;
+		FileIndex localizedFiles;
+
+		// The snapshot the DB was loaded from, if any. This stays mapped since the index is stored in it.
+		std::unique_ptr<MappedFile> snapshot;
+
+		// See FilesByType and FilesByBundle
+		std::once_flag sortedViewsFlag;
+		std::vector<uint32_t> filesByType;
+		std::vector<uint32_t> filesByBundle;
 	};
 
 }; // namespace blt::db
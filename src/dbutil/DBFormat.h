@@ -0,0 +1,76 @@
+#pragma once
+
+#include "platform.h"
+
+#include <stdint.h>
+
+namespace blt::db::format
+{
+
+	// The layouts of the records in the game's bundle_db.blb and bundle header files, which are memory dumps
+	// of the game's own structures - so anything pointer-sized differs between the 32 and 64 bit versions.
+	//
+	// Each header file starts with a 32-bit length, and all the pointers in them are relative to the byte after
+	// that. The pointers in bundle_db.blb are relative to the start of the file.
+
+	struct dsl_Vector
+	{
+		unsigned int size;
+		unsigned int capacity;
+		intptr_t contents_ptr;
+		void* allocator;
+	};
+
+	// bundle_db.blb: a language the assets may be in
+	struct LanguageData
+	{
+		idstring name;
+		int id;
+		int padding; // Probably padding, at least - always zero
+	};
+	static_assert(sizeof(LanguageData) == 16);
+
+	// bundle_db.blb: an asset, which the bundle headers refer to by it's fileId
+	struct MiniFile
+	{
+		idstring type;
+		idstring name;
+		int32_t langId;
+		int32_t zero_1;
+		int32_t fileId;
+		int32_t zero_2;
+	};
+	static_assert(sizeof(MiniFile) == 32); // Same on 32 and 64 bit
+
+	// Package headers: where an asset starts in the package's bundle, it runs until the next one starts
+	struct FilePos
+	{
+		int32_t fileId;
+		int32_t offset;
+	};
+	static_assert(sizeof(FilePos) == 8); // Same on 32 and 64 bit
+
+	// all_h.bundle: one of the all_N.bundle files, and the items in it
+	struct BundleInfo
+	{
+		intptr_t id;
+		intptr_t zero;
+		dsl_Vector vec;
+		intptr_t one;
+	};
+#if defined(__x86_64__) || defined(_WIN64)
+	static_assert(sizeof(BundleInfo) == 48);
+#else
+	static_assert(sizeof(BundleInfo) == 28);
+#endif
+
+	// all_h.bundle: an asset in a bundle. A length of ~0 means it runs until the end of the bundle.
+	struct ItemInfo
+	{
+		uint32_t fileId;
+		uint32_t offset;
+		uint32_t length;
+	};
+	static_assert(sizeof(ItemInfo) == 12); // True on 32/64 bit
+
+}; // namespace blt::db::format
@@ -0,0 +1,408 @@
+//
+// Persistent on-disk copy of the DieselDB index.
+//
+// Parsing bundle_db.blb and all the bundle headers is by far the slowest part of loading the DB, and the
+// result only changes when the game is updated. So once everything has been parsed, the resolved file table,
+// bundle table and lookup indexes are written out to a snapshot file, laid out such that the file table's
+// columns and the indexes can be used straight from a memory mapping on the next launch.
+//
+// The snapshot is keyed on a fingerprint of the size and modification time of every header file, so it's
+// thrown away and rebuilt whenever any of them change.
+//
+
+#include "DB.h"
+
+#include <util/util.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define stat64 _stat64
+#endif
+
+using namespace blt::db;
+using blt::idstring;
+
+static const char* SNAPSHOT_PATH = "mods/saves/sblt_asset_db.cache";
+
+// Bump this whenever the layout of the snapshot (or any of the structures in it) changes
+static const uint32_t SNAPSHOT_VERSION = 3;
+static const char SNAPSHOT_MAGIC[8] = {'S', 'B', 'L', 'T', 'A', 'D', 'B', 0};
+
+// Windows won't replace a file while it's mapped, and a DB loaded from the snapshot keeps it mapped for as long
+// as it's alive. So if the snapshot is rebuilt while an old DB is still using it, the new one is left at its
+// temporary path and moved into place when the last mapping is released.
+static std::mutex snapshot_mutex;
+static int snapshot_mappings = 0;
+static bool snapshot_pending = false;
+
+namespace
+{
+	// The columns of the file table, in the order they're stored in the snapshot
+	enum SnapshotColumn
+	{
+		COL_NAMES,
+		COL_TYPES,
+		COL_LANGUAGES,
+		COL_NEXT,
+		COL_BUNDLES,
+		COL_OFFSETS,
+		COL_LENGTHS,
+		COL_COUNT,
+	};
+
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint64_t fingerprint;
+
+		uint64_t slotCount;
+		uint64_t localizedSlotCount;
+		uint64_t fileCount;
+		uint64_t languageCount;
+		uint64_t bundleCount;
+		uint64_t stringsSize;
+
+		// Offsets of each table from the start of the file, all eight-byte aligned
+		uint64_t slotsOffset;
+		uint64_t localizedSlotsOffset;
+		uint64_t columnOffsets[COL_COUNT];
+		uint64_t languagesOffset;
+		uint64_t bundlesOffset;
+		uint64_t stringsOffset;
+	};
+
+	struct SnapshotBundle
+	{
+		// Offsets and lengths in the string table
+		uint32_t path;
+		uint32_t pathLength;
+		uint32_t headerPath;
+		uint32_t headerPathLength;
+	};
+
+	const uint32_t NONE = ~0u;
+
+	// These all have to be the same on 32 and 64 bit, so the slots can be used in place
+	static_assert(sizeof(SnapshotHeader) == 168);
+	static_assert(sizeof(DslFileTable::Language) == 16);
+	static_assert(sizeof(SnapshotBundle) == 16);
+	static_assert(sizeof(FileIndex::Slot) == 24);
+
+	uint64_t align8(uint64_t value)
+	{
+		return (value + 7) & ~(uint64_t)7;
+	}
+
+	size_t columnWidth(int column)
+	{
+		switch (column)
+		{
+		case COL_NAMES:
+		case COL_TYPES:
+			return sizeof(idstring);
+		case COL_LANGUAGES:
+			return sizeof(uint16_t);
+		default:
+			return sizeof(uint32_t);
+		}
+	}
+
+	// FNV-1a, which is plenty good enough to notice if any of the files changed
+	void hashBytes(uint64_t& hash, const void* data, size_t length)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3;
+		}
+	}
+
+	void hashFile(uint64_t& hash, const std::string& path)
+	{
+		hashBytes(hash, path.c_str(), path.size() + 1);
+
+		struct stat64 info = {};
+		if (stat64(path.c_str(), &info) != 0)
+		{
+			// Still hash something, so a file going missing changes the fingerprint
+			uint64_t missing = ~(uint64_t)0;
+			hashBytes(hash, &missing, sizeof(missing));
+			return;
+		}
+
+		uint64_t size = (uint64_t)info.st_size;
+		int64_t mtime = (int64_t)info.st_mtime;
+		hashBytes(hash, &size, sizeof(size));
+		hashBytes(hash, &mtime, sizeof(mtime));
+#ifndef _WIN32
+		int64_t mtime_ns = (int64_t)info.st_mtim.tv_nsec;
+		hashBytes(hash, &mtime_ns, sizeof(mtime_ns));
+#endif
+	}
+} // namespace
+
+uint64_t DieselDB::Fingerprint(const std::vector<std::string>& packageHeaders)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	// Sort the headers, since the directory listing order isn't guaranteed to be stable
+	std::vector<std::string> sorted = packageHeaders;
+	std::sort(sorted.begin(), sorted.end());
+
+	hashFile(hash, "assets/bundle_db.blb");
+	hashFile(hash, "assets/all_h.bundle");
+	for (const std::string& header : sorted)
+	{
+		hashFile(hash, header);
+	}
+
+	return hash;
+}
+
+bool DieselDB::LoadSnapshot(uint64_t fingerprint)
+{
+	std::unique_ptr<MappedFile> file = MappedFile::Open(SNAPSHOT_PATH, MappedFile::Access::Normal);
+	if (!file)
+		return false;
+
+	SnapshotHeader header = {};
+	if (file->size() < sizeof(header))
+		return false;
+	memcpy(&header, file->data(), sizeof(header));
+
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+	    header.headerSize != sizeof(header))
+	{
+		PD2HOOK_LOG_LOG("Ignoring DB cache from an incompatible version of SuperBLT");
+		return false;
+	}
+
+	if (header.fingerprint != fingerprint)
+	{
+		PD2HOOK_LOG_LOG("Game files have changed since the DB cache was built, rebuilding it");
+		return false;
+	}
+
+	// Make sure all the tables actually lie within the file, so a truncated snapshot can't crash us. The links
+	// between the tables are bounds-checked as they're used, so there's no need to read through them here.
+	auto inBounds = [&](uint64_t offset, uint64_t count, uint64_t size) {
+		return offset % 8 == 0 && offset <= file->size() && count <= (file->size() - offset) / size;
+	};
+	auto isIndexSize = [](uint64_t count) { return count != 0 && (count & (count - 1)) == 0; };
+	bool valid = inBounds(header.slotsOffset, header.slotCount, sizeof(FileIndex::Slot)) &&
+	             inBounds(header.localizedSlotsOffset, header.localizedSlotCount, sizeof(FileIndex::Slot)) &&
+	             inBounds(header.languagesOffset, header.languageCount, sizeof(DslFileTable::Language)) &&
+	             inBounds(header.bundlesOffset, header.bundleCount, sizeof(SnapshotBundle)) &&
+	             inBounds(header.stringsOffset, header.stringsSize, 1) && isIndexSize(header.slotCount) &&
+	             isIndexSize(header.localizedSlotCount) && header.slotCount > header.fileCount &&
+	             header.localizedSlotCount <= header.slotCount && header.fileCount < NONE &&
+	             header.bundleCount < NONE && header.languageCount <= UINT16_MAX + 1;
+	for (int col = 0; col < COL_COUNT; col++)
+	{
+		valid = valid && inBounds(header.columnOffsets[col], header.fileCount, columnWidth(col));
+	}
+	if (!valid)
+	{
+		PD2HOOK_LOG_WARN("DB cache is corrupt, rebuilding it");
+		return false;
+	}
+
+	const uint8_t* base = file->data();
+	const char* strings = (const char*)base + header.stringsOffset;
+
+	std::vector<DieselBundle*> newBundles(header.bundleCount);
+	for (size_t i = 0; i < header.bundleCount; i++)
+	{
+		SnapshotBundle sb;
+		memcpy(&sb, base + header.bundlesOffset + i * sizeof(sb), sizeof(sb));
+
+		if ((uint64_t)sb.path + sb.pathLength > header.stringsSize ||
+		    (uint64_t)sb.headerPath + sb.headerPathLength > header.stringsSize)
+		{
+			PD2HOOK_LOG_WARN("DB cache is corrupt, rebuilding it");
+			return false;
+		}
+
+		newBundles[i] = InternBundle(std::string(strings + sb.path, sb.pathLength),
+		                             std::string(strings + sb.headerPath, sb.headerPathLength));
+	}
+
+	std::vector<DslFileTable::Language> newLanguages(header.languageCount);
+	memcpy(newLanguages.data(), base + header.languagesOffset, newLanguages.size() * sizeof(DslFileTable::Language));
+
+	// The columns are used in-place
+	auto column = [&](int col) { return base + header.columnOffsets[col]; };
+	filesList.count = header.fileCount;
+	filesList.names.Attach((const idstring*)column(COL_NAMES));
+	filesList.types.Attach((const idstring*)column(COL_TYPES));
+	filesList.languages.Attach((const uint16_t*)column(COL_LANGUAGES));
+	filesList.next.Attach((const uint32_t*)column(COL_NEXT));
+	filesList.bundles.Attach((const uint32_t*)column(COL_BUNDLES));
+	filesList.offsets.Attach((const uint32_t*)column(COL_OFFSETS));
+	filesList.lengths.Attach((const uint32_t*)column(COL_LENGTHS));
+	filesList.languageTable = std::move(newLanguages);
+
+	bundles = std::move(newBundles);
+	files.Attach((const FileIndex::Slot*)(base + header.slotsOffset), header.slotCount);
+	localizedFiles.Attach((const FileIndex::Slot*)(base + header.localizedSlotsOffset), header.localizedSlotCount);
+	snapshot = std::move(file);
+
+	std::lock_guard guard(snapshot_mutex);
+	snapshot_mappings++;
+	return true;
+}
+
+static std::string tempSnapshotPath()
+{
+	return std::string(SNAPSHOT_PATH) + ".tmp";
+}
+
+// Move a newly-written snapshot over the old one. Must hold snapshot_mutex.
+static void replaceSnapshot()
+{
+	std::string tmpPath = tempSnapshotPath();
+	snapshot_pending = false;
+
+#ifdef _WIN32
+	bool moved = MoveFileExA(tmpPath.c_str(), SNAPSHOT_PATH, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool moved = rename(tmpPath.c_str(), SNAPSHOT_PATH) == 0;
+#endif
+
+	if (!moved)
+	{
+		PD2HOOK_LOG_WARN(std::string("Failed to move DB cache into place at ") + SNAPSHOT_PATH);
+		remove(tmpPath.c_str());
+	}
+}
+
+void DieselDB::ReleaseSnapshot()
+{
+	if (!snapshot)
+		return;
+
+	snapshot.reset();
+
+	std::lock_guard guard(snapshot_mutex);
+	snapshot_mappings--;
+	if (snapshot_mappings == 0 && snapshot_pending)
+		replaceSnapshot();
+}
+
+void DieselDB::SaveSnapshot(uint64_t fingerprint) const
+{
+	// Build the bundle and string tables
+	std::string strings;
+	std::vector<SnapshotBundle> bundleTable;
+	for (const DieselBundle* bundlePtr : bundles)
+	{
+		const DieselBundle& bundle = *bundlePtr;
+		SnapshotBundle sb = {};
+		sb.path = (uint32_t)strings.size();
+		sb.pathLength = (uint32_t)bundle.path.size();
+		strings += bundle.path;
+		sb.headerPath = (uint32_t)strings.size();
+		sb.headerPathLength = (uint32_t)bundle.headerPath.size();
+		strings += bundle.headerPath;
+
+		bundleTable.push_back(sb);
+	}
+
+	const void* columns[COL_COUNT] = {
+		filesList.names.Data(),   filesList.types.Data(),   filesList.languages.Data(), filesList.next.Data(),
+		filesList.bundles.Data(), filesList.offsets.Data(), filesList.lengths.Data(),
+	};
+
+	SnapshotHeader header = {};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.headerSize = sizeof(header);
+	header.fingerprint = fingerprint;
+	header.slotCount = files.Size();
+	header.localizedSlotCount = localizedFiles.Size();
+	header.fileCount = filesList.Size();
+	header.languageCount = filesList.languageTable.size();
+	header.bundleCount = bundleTable.size();
+	header.stringsSize = strings.size();
+
+	header.slotsOffset = align8(sizeof(header));
+	header.localizedSlotsOffset = align8(header.slotsOffset + header.slotCount * sizeof(FileIndex::Slot));
+	uint64_t end = header.localizedSlotsOffset + header.localizedSlotCount * sizeof(FileIndex::Slot);
+	for (int col = 0; col < COL_COUNT; col++)
+	{
+		header.columnOffsets[col] = align8(end);
+		end = header.columnOffsets[col] + header.fileCount * columnWidth(col);
+	}
+	header.languagesOffset = align8(end);
+	header.bundlesOffset = align8(header.languagesOffset + header.languageCount * sizeof(DslFileTable::Language));
+	header.stringsOffset = align8(header.bundlesOffset + header.bundleCount * sizeof(SnapshotBundle));
+
+	// Write to a temporary file and move it into place, so a crash half-way through can't leave a
+	// broken snapshot behind.
+	std::string tmpPath = tempSnapshotPath();
+	pd2hook::Util::EnsurePathWritable(tmpPath);
+
+	// Hold the lock while writing, so an old DB being released can't move a half-written file into place. This
+	// replaces any snapshot still waiting to be moved, since it's now out of date.
+	std::lock_guard guard(snapshot_mutex);
+	snapshot_pending = false;
+
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		auto writeAt = [&out](uint64_t offset, const void* data, size_t length) {
+			static const char zeros[8] = {0};
+			uint64_t pos = (uint64_t)out.tellp();
+			if (pos < offset)
+				out.write(zeros, offset - pos);
+			out.write((const char*)data, length);
+		};
+
+		writeAt(0, &header, sizeof(header));
+		writeAt(header.slotsOffset, files.Data(), header.slotCount * sizeof(FileIndex::Slot));
+		writeAt(header.localizedSlotsOffset, localizedFiles.Data(), header.localizedSlotCount * sizeof(FileIndex::Slot));
+		for (int col = 0; col < COL_COUNT; col++)
+		{
+			writeAt(header.columnOffsets[col], columns[col], header.fileCount * columnWidth(col));
+		}
+		writeAt(header.languagesOffset, filesList.languageTable.data(),
+		        header.languageCount * sizeof(DslFileTable::Language));
+		writeAt(header.bundlesOffset, bundleTable.data(), bundleTable.size() * sizeof(SnapshotBundle));
+		writeAt(header.stringsOffset, strings.data(), strings.size());
+
+		if (!out.good())
+		{
+			PD2HOOK_LOG_WARN("Failed to write DB cache to " + tmpPath);
+			out.close();
+			remove(tmpPath.c_str());
+			return;
+		}
+	}
+
+#ifdef _WIN32
+	if (snapshot_mappings > 0)
+	{
+		PD2HOOK_LOG_LOG("The old DB cache is still in use, it will be replaced once the old DB is released");
+		snapshot_pending = true;
+		return;
+	}
+#endif
+
+	replaceSnapshot();
+}
+
+void DieselDB::DeleteSnapshot()
+{
+	remove(SNAPSHOT_PATH);
+}
@@ -0,0 +1,134 @@
+#include "DBWatcher.h"
+#include "DB.h"
+
+#include <util/util.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace blt::db;
+
+static const char* ASSETS_DIR = "assets";
+
+// Wait until nothing has changed for this long before reloading, so we don't start rebuilding the DB when only
+// half of an update has been written out.
+static const int QUIET_PERIOD_MS = 2000;
+
+#ifdef _WIN32
+
+static void watch()
+{
+	// This doesn't say which file changed, but that's fine - reloading checks if the headers changed first
+	HANDLE handle = FindFirstChangeNotificationA(
+	    ASSETS_DIR, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		PD2HOOK_LOG_WARN("Failed to watch the assets directory, the DB won't be reloaded if the game is updated");
+		return;
+	}
+
+	bool pending = false;
+	while (true)
+	{
+		DWORD result = WaitForSingleObject(handle, pending ? QUIET_PERIOD_MS : INFINITE);
+		if (result == WAIT_TIMEOUT)
+		{
+			pending = false;
+			DieselDB::Reload();
+			continue;
+		}
+
+		if (result != WAIT_OBJECT_0 || !FindNextChangeNotification(handle))
+			break;
+		pending = true;
+	}
+
+	PD2HOOK_LOG_WARN("Stopped watching the assets directory");
+	FindCloseChangeNotification(handle);
+}
+
+#else
+
+// Check if a file in the assets directory is one the DB is built from
+static bool isHeader(const char* name)
+{
+	static const char suffix[] = "_h.bundle";
+	size_t len = strlen(name);
+	size_t suffixLen = sizeof(suffix) - 1;
+
+	if (len >= suffixLen && strcmp(name + len - suffixLen, suffix) == 0)
+		return true;
+
+	return strcmp(name, "bundle_db.blb") == 0;
+}
+
+static void watch()
+{
+	// Touching a file also changes the fingerprint the DB is checked against, so watch for that too
+	uint32_t mask = IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd == -1 || inotify_add_watch(fd, ASSETS_DIR, mask) == -1)
+	{
+		PD2HOOK_LOG_WARN(std::string("Failed to watch the assets directory, the DB won't be reloaded if the game is "
+		                             "updated: ") +
+		                 strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+	alignas(struct inotify_event) char buff[4096];
+	bool pending = false;
+	while (true)
+	{
+		pollfd pfd = {fd, POLLIN, 0};
+		int result = poll(&pfd, 1, pending ? QUIET_PERIOD_MS : -1);
+		if (result == 0)
+		{
+			pending = false;
+			DieselDB::Reload();
+			continue;
+		}
+
+		ssize_t len = result > 0 ? read(fd, buff, sizeof(buff)) : -1;
+		if (len <= 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (char* ptr = buff; ptr < buff + len;)
+		{
+			const inotify_event* event = (const inotify_event*)ptr;
+			if (event->len && isHeader(event->name))
+				pending = true;
+			ptr += sizeof(inotify_event) + event->len;
+		}
+	}
+
+	PD2HOOK_LOG_WARN(std::string("Stopped watching the assets directory: ") + strerror(errno));
+	close(fd);
+}
+
+#endif
+
+void blt::db::WatchForChanges()
+{
+	static std::once_flag started;
+	std::call_once(started, []() { std::thread(watch).detach(); });
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace blt::db
+{
+
+	/**
+	 * Start watching the game's assets directory, and reload the DB (see DieselDB::Reload) whenever the bundle
+	 * headers change - for example if Steam updates the game while it's running. This returns immediately, and
+	 * the watching is done on a background thread. Calling it again does nothing.
+	 */
+	void WatchForChanges();
+
+}; // namespace blt::db
@@ -1,6 +1,8 @@
 #include "Datastore.h"
 #include "util/util.h"
 
+#include <algorithm>
+
 #include <assert.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -98,45 +100,259 @@ bool BLTFileDataStore::good() const
 	abort();
 }
 
-// BLTStringDataStore
+// BLTSharedFile
+
+std::shared_ptr<BLTSharedFile> BLTSharedFile::Open(const std::string& filePath)
+{
+	int flags = O_RDONLY;
+#ifdef _WIN32
+	// Windows Wart - suppress text file conversion
+	flags |= O_BINARY;
+#endif
+	int fd = open(filePath.c_str(), flags);
+	if (fd == -1)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<BLTSharedFile> file(new BLTSharedFile());
+	file->fd = fd;
+
+	int64_t res = lseek64(fd, 0, SEEK_END);
+	assert(res != -1);
+	file->file_size = (size_t)res;
+
+	return file;
+}
+
+BLTSharedFile::~BLTSharedFile()
+{
+	::close(fd);
+}
+
+size_t BLTSharedFile::ReadAt(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+#ifdef _WIN32
+	std::lock_guard guard(mutex);
+	lseek64(fd, position_in_file, SEEK_SET);
+	int count = ::read(fd, data, (unsigned int)length);
+	return count < 0 ? 0 : (size_t)count;
+#else
+	// Keep going after short reads, so a read only comes up short at the end of the file
+	size_t done = 0;
+	while (done < length)
+	{
+		ssize_t count = pread(fd, data + done, length - done, (off_t)(position_in_file + done));
+		if (count <= 0)
+			break;
+		done += (size_t)count;
+	}
+	return done;
+#endif
+}
+
+size_t BLTSharedFile::Size() const
+{
+	return file_size;
+}
+
+// BLTSharedFileDataStore
+
+BLTSharedFileDataStore::BLTSharedFileDataStore(std::shared_ptr<BLTSharedFile> file) : file(std::move(file))
+{
+}
+
+size_t BLTSharedFileDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	size_t count = file->ReadAt(position_in_file, data, length);
+	assert(count == length);
+
+	return count;
+}
+
+bool BLTSharedFileDataStore::close()
+{
+	PD2HOOK_LOG_ERROR("BLTSharedFileDataStore::close called - unimplemented!");
+	abort();
+}
+
+size_t BLTSharedFileDataStore::size() const
+{
+	return file->Size();
+}
+
+bool BLTSharedFileDataStore::is_asynchronous() const
+{
+	return false;
+}
+
+bool BLTSharedFileDataStore::good() const
+{
+	return true;
+}
+
+// BLTMappedDataStore
 
-BLTStringDataStore::BLTStringDataStore(std::string contents) : contents(std::move(contents))
+BLTMappedDataStore* BLTMappedDataStore::Open(const std::string& filePath, blt::db::MappedFile::Access access)
 {
+	std::shared_ptr<const blt::db::MappedFile> file = blt::db::MappedFile::Open(filePath, access);
+	if (!file)
+		return nullptr;
+
+	return new BLTMappedDataStore(std::move(file));
 }
 
-size_t BLTStringDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+BLTMappedDataStore::BLTMappedDataStore(std::shared_ptr<const blt::db::MappedFile> file) : file(std::move(file))
+{
+}
+
+size_t BLTMappedDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
 {
 	// If the start of the read is past the end, stop here
-	if (position_in_file >= contents.size())
+	if (position_in_file >= file->size())
 		return 0;
 
 	// If the end of the read is past the end, shrink it down so it'll fit
-	size_t remaining = contents.size() - position_in_file;
+	size_t remaining = file->size() - position_in_file;
 	if (remaining < length)
 		length = remaining;
 
-	memcpy(data, contents.c_str(), length);
+	memcpy(data, file->data() + position_in_file, length);
 	return length;
 }
 
-bool BLTStringDataStore::close()
+bool BLTMappedDataStore::close()
 {
-	PD2HOOK_LOG_ERROR("BLTStringDataStore::close called - unimplemented!");
+	PD2HOOK_LOG_ERROR("BLTMappedDataStore::close called - unimplemented!");
 	abort();
-	// What are we supposed to return?
 }
 
-size_t BLTStringDataStore::size() const
+size_t BLTMappedDataStore::size() const
+{
+	return file->size();
+}
+
+bool BLTMappedDataStore::is_asynchronous() const
+{
+	return false;
+}
+
+bool BLTMappedDataStore::good() const
+{
+	return true;
+}
+
+// BLTBufferedDataStore
+
+BLTBufferedDataStore::BLTBufferedDataStore(BLTAbstractDataStore* inner, size_t windowSize)
+	: inner(inner), windowSize(windowSize)
+{
+	assert(windowSize != 0 && windowSize % WINDOW_ALIGNMENT == 0);
+}
+
+size_t BLTBufferedDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	// If the start of the read is past the end, stop here
+	size_t file_size = inner->size();
+	if (position_in_file >= file_size)
+		return 0;
+
+	// If the end of the read is past the end, shrink it down so it'll fit
+	size_t remaining = file_size - position_in_file;
+	if (remaining < length)
+		length = remaining;
+
+	// Copying a large read through the window wouldn't save any reads
+	if (length >= windowSize)
+		return inner->read(position_in_file, data, length);
+
+	std::lock_guard guard(mutex);
+	if (window.empty())
+		window.resize(windowSize);
+
+	size_t done = 0;
+	while (done < length)
+	{
+		uint64_t pos = position_in_file + done;
+		if (pos < windowStart || pos >= windowStart + windowLength)
+		{
+			windowStart = pos & ~(uint64_t)(WINDOW_ALIGNMENT - 1);
+			windowLength = inner->read(windowStart, window.data(), std::min<size_t>(windowSize, file_size - windowStart));
+
+			// The inner datastore came up short, so there's nothing more to read
+			if (pos >= windowStart + windowLength)
+				break;
+		}
+
+		size_t offset = (size_t)(pos - windowStart);
+		size_t count = std::min(length - done, windowLength - offset);
+		memcpy(data + done, window.data() + offset, count);
+		done += count;
+	}
+
+	return done;
+}
+
+bool BLTBufferedDataStore::close()
+{
+	return inner->close();
+}
+
+size_t BLTBufferedDataStore::size() const
+{
+	return inner->size();
+}
+
+bool BLTBufferedDataStore::is_asynchronous() const
+{
+	return false;
+}
+
+bool BLTBufferedDataStore::good() const
+{
+	return inner->good();
+}
+
+// BLTSharedBufferDataStore
+
+BLTSharedBufferDataStore::BLTSharedBufferDataStore(std::shared_ptr<const std::vector<uint8_t>> contents)
+	: contents(std::move(contents))
+{
+}
+
+size_t BLTSharedBufferDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	// If the start of the read is past the end, stop here
+	if (position_in_file >= contents->size())
+		return 0;
+
+	// If the end of the read is past the end, shrink it down so it'll fit
+	size_t remaining = contents->size() - position_in_file;
+	if (remaining < length)
+		length = remaining;
+
+	memcpy(data, contents->data() + position_in_file, length);
+	return length;
+}
+
+bool BLTSharedBufferDataStore::close()
+{
+	// There's nothing to close, the buffer is freed once the last thing using it is done with it. The engine may
+	// close recoded custom assets on Linux, which used to have their own datastore that did nothing here too.
+	return true;
+}
+
+size_t BLTSharedBufferDataStore::size() const
 {
-	return contents.size();
+	return contents->size();
 }
 
-bool BLTStringDataStore::is_asynchronous() const
+bool BLTSharedBufferDataStore::is_asynchronous() const
 {
 	return false;
 }
 
-bool BLTStringDataStore::good() const
+bool BLTSharedBufferDataStore::good() const
 {
 	return true;
 }
@@ -1,6 +1,11 @@
 #pragma once
 
+#include "MappedFile.h"
+
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <stdint.h>
 
@@ -43,14 +48,118 @@ class BLTFileDataStore : public BLTAbstractDataStore
 	size_t file_size = 0;
 };
 
-class BLTStringDataStore : public BLTAbstractDataStore
+// A read-only file which may be shared between any number of datastores (and threads), as reads don't move
+// a shared file position. The file is closed once the last reference to it is gone.
+class BLTSharedFile
+{
+  public:
+	BLTSharedFile(const BLTSharedFile&) = delete;
+	BLTSharedFile& operator=(const BLTSharedFile&) = delete;
+
+	// Returns null if the file can't be opened
+	static std::shared_ptr<BLTSharedFile> Open(const std::string& filePath);
+	~BLTSharedFile();
+
+	size_t ReadAt(uint64_t position_in_file, uint8_t* data, size_t length);
+	size_t Size() const;
+
+  private:
+	BLTSharedFile() = default;
+	int fd = -1;
+	size_t file_size = 0;
+
+#ifdef _WIN32
+	// There's no pread on Windows, so the seek and read have to happen together
+	std::mutex mutex;
+#endif
+};
+
+// A view of a shared file, so handing out a datastore doesn't require opening the file again.
+class BLTSharedFileDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTSharedFileDataStore(const BLTSharedFileDataStore&) = delete;
+	BLTSharedFileDataStore& operator=(const BLTSharedFileDataStore&) = delete;
+
+	explicit BLTSharedFileDataStore(std::shared_ptr<BLTSharedFile> file);
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	std::shared_ptr<BLTSharedFile> file;
+};
+
+// Reads from a read-only memory mapping of a file, so each read is a copy out of the page cache rather than
+// a system call. The mapping may be shared between any number of these.
+class BLTMappedDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTMappedDataStore(const BLTMappedDataStore&) = delete;
+	BLTMappedDataStore& operator=(const BLTMappedDataStore&) = delete;
+
+	// Returns null if the file can't be opened or mapped
+	static BLTMappedDataStore* Open(const std::string& filePath,
+	                                blt::db::MappedFile::Access access = blt::db::MappedFile::Access::Preload);
+
+	explicit BLTMappedDataStore(std::shared_ptr<const blt::db::MappedFile> file);
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	std::shared_ptr<const blt::db::MappedFile> file;
+};
+
+// Serves small reads from a window read ahead from another datastore, so the engine reading an asset in lots of
+// small pieces (a few header fields, then each of it's chunks) only costs a read of the underlying datastore each
+// time it moves past the window. Reads at least as big as the window skip it, and go straight through.
+class BLTBufferedDataStore : public BLTAbstractDataStore
+{
+  public:
+	static const size_t DEFAULT_WINDOW_SIZE = 32 * 1024;
+
+	// The window starts on a multiple of this, so reads from the inner datastore line up with the page cache
+	static const size_t WINDOW_ALIGNMENT = 4096;
+
+	// Delete default crap
+	BLTBufferedDataStore(const BLTBufferedDataStore&) = delete;
+	BLTBufferedDataStore& operator=(const BLTBufferedDataStore&) = delete;
+
+	// This takes ownership of the inner datastore. The window size must be a multiple of WINDOW_ALIGNMENT.
+	explicit BLTBufferedDataStore(BLTAbstractDataStore* inner, size_t windowSize = DEFAULT_WINDOW_SIZE);
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	std::unique_ptr<BLTAbstractDataStore> inner;
+	size_t windowSize;
+
+	std::mutex mutex;
+	std::vector<uint8_t> window; // Allocated on the first small read
+	uint64_t windowStart = 0;
+	size_t windowLength = 0;
+};
+
+// A read-only view of a reference-counted buffer, which may be shared with any number of other datastores
+// (and anything else holding on to it) without copying it.
+class BLTSharedBufferDataStore : public BLTAbstractDataStore
 {
   public:
 	// Delete default crap
-	BLTStringDataStore(const BLTStringDataStore&) = delete;
-	BLTStringDataStore& operator=(const BLTStringDataStore&) = delete;
+	BLTSharedBufferDataStore(const BLTSharedBufferDataStore&) = delete;
+	BLTSharedBufferDataStore& operator=(const BLTSharedBufferDataStore&) = delete;
 
-	explicit BLTStringDataStore(std::string contents);
+	explicit BLTSharedBufferDataStore(std::shared_ptr<const std::vector<uint8_t>> contents);
 	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
 	virtual bool close() override;
 	virtual size_t size() const override;
@@ -58,5 +167,5 @@ class BLTStringDataStore : public BLTAbstractDataStore
 	virtual bool good() const override;
 
   private:
-	std::string contents;
+	std::shared_ptr<const std::vector<uint8_t>> contents;
 };
@@ -0,0 +1,158 @@
+#include "IoStats.h"
+
+#include <util/util.h>
+
+#include <chrono>
+
+#include <stdio.h>
+
+using namespace blt::db;
+
+const char* blt::db::IoSourceName(IoSource source)
+{
+	switch (source)
+	{
+	case IoSource::PlainFile:
+		return "plain_file";
+	case IoSource::Bundle:
+		return "bundle";
+	case IoSource::Wren:
+		return "wren";
+	case IoSource::String:
+	default:
+		return "string";
+	}
+}
+
+uint64_t IoStats::Counters::Percentile(double fraction) const
+{
+	uint64_t target = (uint64_t)(reads * fraction);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if (seen > target)
+			return (uint64_t)1 << (i + 8);
+	}
+	return (uint64_t)1 << (HISTOGRAM_BUCKETS + 8);
+}
+
+IoStats& IoStats::Instance()
+{
+	static IoStats instance;
+	return instance;
+}
+
+void IoStats::SetEnabled(bool value)
+{
+	enabled = value;
+}
+
+bool IoStats::IsEnabled() const
+{
+	return enabled;
+}
+
+BLTAbstractDataStore* IoStats::Wrap(BLTAbstractDataStore* datastore, IoSource source)
+{
+	if (!datastore || !enabled.load(std::memory_order_relaxed))
+		return datastore;
+
+	counters[(size_t)source].opens++;
+	return new BLTInstrumentedDataStore(datastore, source);
+}
+
+void IoStats::Record(IoSource source, size_t bytes, uint64_t nanos)
+{
+	size_t bucket = 0;
+	while (bucket < HISTOGRAM_BUCKETS - 1 && nanos >= ((uint64_t)1 << (bucket + 8)))
+		bucket++;
+
+	// These are only ever read for reporting, so they don't need to be consistent with each other
+	AtomicCounters& c = counters[(size_t)source];
+	c.reads.fetch_add(1, std::memory_order_relaxed);
+	c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+	c.nanos.fetch_add(nanos, std::memory_order_relaxed);
+	c.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+IoStats::Counters IoStats::Get(IoSource source) const
+{
+	const AtomicCounters& c = counters[(size_t)source];
+
+	Counters result = {c.opens, c.reads, c.bytes, c.nanos, {}};
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		result.histogram[i] = c.histogram[i];
+	return result;
+}
+
+void IoStats::Reset()
+{
+	for (AtomicCounters& c : counters)
+	{
+		c.opens = 0;
+		c.reads = 0;
+		c.bytes = 0;
+		c.nanos = 0;
+		for (std::atomic<uint64_t>& bucket : c.histogram)
+			bucket = 0;
+	}
+}
+
+void IoStats::Log() const
+{
+	if (!enabled)
+		return;
+
+	PD2HOOK_LOG_LOG("Asset IO stats:");
+	for (size_t i = 0; i < IO_SOURCE_COUNT; i++)
+	{
+		Counters c = Get((IoSource)i);
+		if (c.opens == 0)
+			continue;
+
+		char buff[256];
+		snprintf(buff, sizeof(buff),
+		         "  %-10s %8llu opens %10llu reads %10.2f MiB %10.3f ms total, p50 < %.2f us, p99 < %.2f us",
+		         IoSourceName((IoSource)i), (unsigned long long)c.opens, (unsigned long long)c.reads,
+		         c.bytes / 1024.0 / 1024.0, c.nanos / 1e6, c.Percentile(0.5) / 1e3, c.Percentile(0.99) / 1e3);
+		PD2HOOK_LOG_LOG(buff);
+	}
+}
+
+// BLTInstrumentedDataStore
+
+BLTInstrumentedDataStore::BLTInstrumentedDataStore(BLTAbstractDataStore* inner, IoSource source)
+    : inner(inner), source(source)
+{
+}
+
+size_t BLTInstrumentedDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	auto start = std::chrono::steady_clock::now();
+	size_t count = inner->read(position_in_file, data, length);
+	auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+	IoStats::Instance().Record(source, count, (uint64_t)nanos.count());
+	return count;
+}
+
+bool BLTInstrumentedDataStore::close()
+{
+	return inner->close();
+}
+
+size_t BLTInstrumentedDataStore::size() const
+{
+	return inner->size();
+}
+
+bool BLTInstrumentedDataStore::is_asynchronous() const
+{
+	return inner->is_asynchronous();
+}
+
+bool BLTInstrumentedDataStore::good() const
+{
+	return inner->good();
+}
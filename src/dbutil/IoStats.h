@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Datastore.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	// Where the contents of a datastore handed to the engine come from
+	enum class IoSource
+	{
+		PlainFile, // A file from a mod, possibly compressed
+		Bundle,    // An asset from one of the game's bundles
+		Wren,      // A string from a Wren asset loader
+		String,    // An asset SuperBLT generated in memory, such as a recoded custom asset
+	};
+	static const size_t IO_SOURCE_COUNT = 4;
+
+	const char* IoSourceName(IoSource source);
+
+	/**
+	 * Counts the reads the engine makes from the datastores SuperBLT gives it, to find out how much the assets we
+	 * serve cost. This is off by default, in which case datastores aren't wrapped at all and it costs nothing.
+	 *
+	 * Only datastores opened while it's enabled are counted, so enable it before the assets of interest load.
+	 */
+	class IoStats
+	{
+	  public:
+		// Bucket i counts reads which took under 2^(i+8) nanoseconds (so the first is under 256ns, and the
+		// second last is under about 1s). The last bucket counts everything slower than that.
+		static const size_t HISTOGRAM_BUCKETS = 24;
+
+		struct Counters
+		{
+			uint64_t opens;
+			uint64_t reads;
+			uint64_t bytes;
+			uint64_t nanos; // The total time spent reading
+			uint64_t histogram[HISTOGRAM_BUCKETS];
+
+			// Estimate the time under which the given fraction of reads finished, from the histogram
+			[[nodiscard]] uint64_t Percentile(double fraction) const;
+		};
+
+		static IoStats& Instance();
+
+		void SetEnabled(bool enabled);
+		[[nodiscard]] bool IsEnabled() const;
+
+		/**
+		 * Wrap a datastore so it's reads are counted, or return it unchanged if counting is disabled. The wrapper
+		 * takes ownership of the datastore.
+		 */
+		BLTAbstractDataStore* Wrap(BLTAbstractDataStore* datastore, IoSource source);
+
+		void Record(IoSource source, size_t bytes, uint64_t nanos);
+
+		[[nodiscard]] Counters Get(IoSource source) const;
+
+		void Reset();
+
+		/** Write the counters to the log, if counting is enabled. */
+		void Log() const;
+
+	  private:
+		IoStats() = default;
+
+		struct AtomicCounters
+		{
+			std::atomic<uint64_t> opens{0};
+			std::atomic<uint64_t> reads{0};
+			std::atomic<uint64_t> bytes{0};
+			std::atomic<uint64_t> nanos{0};
+			std::atomic<uint64_t> histogram[HISTOGRAM_BUCKETS] = {};
+		};
+
+		std::atomic<bool> enabled{false};
+		AtomicCounters counters[IO_SOURCE_COUNT];
+	};
+
+}; // namespace blt::db
+
+// Times each read from another datastore, and adds it to the IoStats counters
+class BLTInstrumentedDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTInstrumentedDataStore(const BLTInstrumentedDataStore&) = delete;
+	BLTInstrumentedDataStore& operator=(const BLTInstrumentedDataStore&) = delete;
+
+	BLTInstrumentedDataStore(BLTAbstractDataStore* inner, blt::db::IoSource source);
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	std::unique_ptr<BLTAbstractDataStore> inner;
+	blt::db::IoSource source;
+};
@@ -0,0 +1,103 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace blt::db;
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path, Access access)
+{
+	std::unique_ptr<MappedFile> file(new MappedFile());
+	file->filename = path;
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                            FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return nullptr;
+	file->file_handle = handle;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size))
+		return nullptr;
+	file->length = (size_t)size.QuadPart;
+
+	// Windows won't map an empty file, but there's nothing to read anyway
+	if (file->length == 0)
+		return file;
+
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+		return nullptr;
+	file->mapping_handle = mapping;
+
+	file->contents = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (file->contents == nullptr)
+		return nullptr;
+
+	// Windows doesn't have an equivalent of madvise that's available everywhere the game runs, so the access
+	// pattern is left to it's normal read-ahead.
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return nullptr;
+
+	struct stat info = {};
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	file->length = (size_t)info.st_size;
+
+	// mmap rejects zero-length mappings, but there's nothing to read anyway
+	if (file->length == 0)
+	{
+		close(fd);
+		return file;
+	}
+
+	// Have small files read in as part of mapping them, rather than page faulting on each page as it's read
+	int flags = MAP_PRIVATE;
+	bool small = file->length <= PRELOAD_LIMIT;
+	if (access == Access::Preload && small)
+		flags |= MAP_POPULATE;
+
+	void* addr = mmap(nullptr, file->length, PROT_READ, flags, fd, 0);
+
+	// The mapping holds it's own reference to the file, so we don't need the descriptor anymore
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		return nullptr;
+	file->contents = (const uint8_t*)addr;
+
+	if (access == Access::Sequential)
+		madvise(addr, file->length, MADV_SEQUENTIAL);
+	else if (access == Access::Preload && !small)
+		madvise(addr, file->length, MADV_WILLNEED);
+#endif
+
+	return file;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (contents)
+		UnmapViewOfFile(contents);
+	if (mapping_handle)
+		CloseHandle(mapping_handle);
+	if (file_handle)
+		CloseHandle(file_handle);
+#else
+	if (contents)
+		munmap((void*)contents, length);
+#endif
+}
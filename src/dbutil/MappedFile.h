@@ -0,0 +1,73 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * A read-only memory mapping of an entire file.
+	 *
+	 * This lets the DB loader read the bundle headers in place, without going through a stream and
+	 * copying everything into temporary buffers. The mapping is released when this object is destroyed.
+	 */
+	class MappedFile
+	{
+	  public:
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile();
+
+		// How the mapping is going to be read, so the OS can read the file in ahead of time
+		enum class Access
+		{
+			// No particular pattern, which leaves it to the OS's default read-ahead
+			Normal,
+
+			// The file will be read from front to back, so the OS can read ahead aggressively
+			Sequential,
+
+			// The file will be read in full soon. If it's small (see PRELOAD_LIMIT) it's read in immediately,
+			// otherwise the OS is asked to start reading it in the background.
+			Preload,
+		};
+
+		// Files up to this size are read in when they're mapped with Access::Preload
+		static const size_t PRELOAD_LIMIT = 1024 * 1024;
+
+		// Returns null if the file couldn't be opened or mapped.
+		static std::unique_ptr<MappedFile> Open(const std::string& path, Access access = Access::Sequential);
+
+		[[nodiscard]] const uint8_t* data() const
+		{
+			return contents;
+		}
+
+		[[nodiscard]] size_t size() const
+		{
+			return length;
+		}
+
+		[[nodiscard]] const std::string& path() const
+		{
+			return filename;
+		}
+
+	  private:
+		MappedFile() = default;
+
+		std::string filename;
+		const uint8_t* contents = nullptr;
+		size_t length = 0;
+
+#ifdef _WIN32
+		void* file_handle = nullptr;
+		void* mapping_handle = nullptr;
+#endif
+	};
+
+}; // namespace blt::db
@@ -0,0 +1,212 @@
+#include "Prefetch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace blt::db;
+
+static std::atomic<size_t> pending_prefetches{0};
+
+// Prefetches are done one after another on a single worker thread, which is started when there's something to
+// do and exits once it's been idle for a while - the same as the async IO threads. Running them in parallel
+// wouldn't help much anyway, since they're all waiting on the same disk.
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+static std::queue<std::vector<PrefetchRange>> queue;
+static bool worker_running = false;
+
+PrefetchRange PrefetchRange::OfFile(const DslFile& file)
+{
+	// End-of-file assets have no length, which conveniently is what a zero length means here
+	return PrefetchRange{file.bundle->path, file.offset, file.HasLength() ? file.length : 0};
+}
+
+PrefetchRange PrefetchRange::OfWholeFile(std::string path)
+{
+	return PrefetchRange{std::move(path), 0, 0};
+}
+
+#ifdef _WIN32
+
+// Windows doesn't have an equivalent of posix_fadvise for files that aren't memory-mapped, so just read the
+// data and throw it away, which leaves it in the system's file cache.
+static void prefetchFile(const std::string& path, const std::vector<PrefetchRange*>& ranges)
+{
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return;
+
+	static const DWORD CHUNK_SIZE = 1024 * 1024;
+	std::vector<uint8_t> buffer(CHUNK_SIZE);
+
+	for (const PrefetchRange* range : ranges)
+	{
+		LARGE_INTEGER pos;
+		pos.QuadPart = (LONGLONG)range->offset;
+		if (!SetFilePointerEx(handle, pos, nullptr, FILE_BEGIN))
+			continue;
+
+		uint64_t remaining = range->length == 0 ? ~(uint64_t)0 : range->length;
+		while (remaining > 0)
+		{
+			DWORD read = 0;
+			DWORD toRead = (DWORD)std::min<uint64_t>(remaining, CHUNK_SIZE);
+			if (!ReadFile(handle, buffer.data(), toRead, &read, nullptr) || read == 0)
+				break;
+			remaining -= read;
+		}
+	}
+
+	CloseHandle(handle);
+}
+
+#else
+
+static void prefetchFile(const std::string& path, const std::vector<PrefetchRange*>& ranges)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+
+	for (const PrefetchRange* range : ranges)
+	{
+		posix_fadvise(fd, (off_t)range->offset, (off_t)range->length, POSIX_FADV_WILLNEED);
+	}
+
+	close(fd);
+}
+
+#endif
+
+static void prefetchRanges(std::vector<PrefetchRange>& ranges)
+{
+	// Group the ranges by file, and sort each file's ranges, so each file is only opened once and read
+	// from front to back.
+	std::map<std::string, std::vector<PrefetchRange*>> files;
+	for (PrefetchRange& range : ranges)
+	{
+		files[range.path].push_back(&range);
+	}
+
+	for (auto& [path, fileRanges] : files)
+	{
+		std::sort(fileRanges.begin(), fileRanges.end(),
+		          [](const PrefetchRange* a, const PrefetchRange* b) { return a->offset < b->offset; });
+		prefetchFile(path, fileRanges);
+	}
+}
+
+static void prefetchWorker()
+{
+	while (true)
+	{
+		std::vector<PrefetchRange> ranges;
+		{
+			std::unique_lock lock(queue_mutex);
+			bool hasItem = queue_cv.wait_for(lock, std::chrono::seconds(1), []() { return !queue.empty(); });
+			if (!hasItem)
+			{
+				worker_running = false;
+				return;
+			}
+
+			ranges = std::move(queue.front());
+			queue.pop();
+		}
+
+		prefetchRanges(ranges);
+		pending_prefetches--;
+	}
+}
+
+void blt::db::Prefetch(std::vector<PrefetchRange> ranges)
+{
+	pending_prefetches++;
+
+	std::lock_guard guard(queue_mutex);
+	queue.push(std::move(ranges));
+
+	if (worker_running)
+	{
+		queue_cv.notify_one();
+		return;
+	}
+
+	worker_running = true;
+	std::thread(prefetchWorker).detach();
+}
+
+size_t blt::db::PendingPrefetches()
+{
+	return pending_prefetches;
+}
+
+std::optional<Residency> blt::db::QueryResidency(const PrefetchRange& range)
+{
+#ifdef _WIN32
+	return std::nullopt;
+#else
+	// If the file is missing or the range is empty, there's nothing to be resident
+	int fd = open(range.path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return Residency{0, 0};
+
+	struct stat info = {};
+	if (fstat(fd, &info) != 0 || range.offset >= (uint64_t)info.st_size)
+	{
+		close(fd);
+		return Residency{0, 0};
+	}
+
+	uint64_t end = (uint64_t)info.st_size;
+	if (range.length != 0)
+		end = std::min(end, range.offset + range.length);
+
+	// mincore works on whole pages of a mapping, so map the pages covering the range
+	uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = range.offset - range.offset % pageSize;
+	size_t mapLength = (size_t)(end - start);
+	void* addr = mmap(nullptr, mapLength, PROT_READ, MAP_SHARED, fd, (off_t)start);
+	close(fd);
+
+	Residency residency{0, end - range.offset};
+	if (addr == MAP_FAILED)
+		return residency;
+
+	std::vector<unsigned char> pages((mapLength + pageSize - 1) / pageSize);
+	int res = mincore(addr, mapLength, pages.data());
+	munmap(addr, mapLength);
+
+	if (res != 0)
+		return residency;
+
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		if (!(pages[i] & 1))
+			continue;
+
+		// Only count the part of the page that's inside the range
+		uint64_t pageStart = std::max(start + i * pageSize, range.offset);
+		uint64_t pageEnd = std::min(start + (i + 1) * pageSize, end);
+		residency.resident += pageEnd - pageStart;
+	}
+
+	return residency;
+#endif
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "DB.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db
+{
+
+	/**
+	 * A range of bytes in a file on disk, which may be read in the near future. A length of zero means the
+	 * range continues until the end of the file.
+	 */
+	struct PrefetchRange
+	{
+		std::string path;
+		uint64_t offset;
+		uint64_t length;
+
+		static PrefetchRange OfFile(const DslFile& file);
+		static PrefetchRange OfWholeFile(std::string path);
+	};
+
+	/**
+	 * Ask the OS to start reading the given ranges into it's page cache, so they can be read later without
+	 * waiting on the disk. This returns immediately, and the work is queued up for a single background thread.
+	 */
+	void Prefetch(std::vector<PrefetchRange> ranges);
+
+	/** The number of calls to Prefetch that haven't finished yet. */
+	size_t PendingPrefetches();
+
+	struct Residency
+	{
+		uint64_t resident; // Bytes in the page cache
+		uint64_t total;
+	};
+
+	/**
+	 * Find how much of a range of a file is currently in the page cache. A missing file has nothing resident.
+	 * This isn't supported on all platforms, in which case nothing is returned.
+	 */
+	std::optional<Residency> QueryResidency(const PrefetchRange& range);
+
+}; // namespace blt::db
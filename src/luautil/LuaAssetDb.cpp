@@ -3,11 +3,18 @@
 //
 
 #include "LuaAssetDb.h"
+#include "LuaAsyncIO.h"
 
+#include <dbutil/AccessTrace.h>
+#include <dbutil/AssetCache.h>
+#include <dbutil/AssetQuery.h>
+#include <dbutil/BatchRead.h>
 #include <dbutil/DB.h>
+#include <dbutil/Prefetch.h>
 #include <errno.h>
 #include <fstream>
 #include <inttypes.h>
+#include <new>
 #include <platform.h>
 #include <string.h>
 #include <util/util.h>
@@ -60,37 +67,38 @@ static idstring to_idstring(lua_State* L, int idx, const char* err_name = nullpt
 	return blt::idstring_hash(str);
 }
 
-static DslFile* find_file(lua_State* L)
+// Read the language and fallback options from the options table at the given index, if there is one. The
+// result is whether to fall back to the language-less or English versions of a file if it's not available in
+// the requested language, which must be asked for explicitly. Otherwise only an exact match is used.
+static bool get_language(lua_State* L, int options, idstring* lang)
 {
-	idstring name = to_idstring(L, 1);
-	idstring ext = to_idstring(L, 2);
+	*lang = 0;
+	if (!lua_istable(L, options))
+		return false;
 
-	// 3rd arg is an options table
-	idstring lang = 0;
-	if (lua_istable(L, 3))
+	lua_getfield(L, options, "language");
+	// Use toboolean instead of isnil to supplying false is the same as nil
+	if (lua_toboolean(L, -1))
 	{
-		lua_getfield(L, 3, "language");
-		// Use toboolean instead of isnil to supplying false is the same as nil
-		if (lua_toboolean(L, -1))
-			lang = to_idstring(L, -1, "options.language");
-		lua_pop(L, 1);
+		*lang = to_idstring(L, -1, "options.language");
 	}
+	lua_pop(L, 1);
 
-	DslFile* file = DieselDB::Instance()->Find(name, ext);
-
-	// If it's not found, stop here - otherwise we'll crash when finding the language ID
-	if (!file)
-		return nullptr;
+	lua_getfield(L, options, "fallback");
+	bool fallback = lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	return fallback;
+}
 
-	// Iterate though the different language versions of this file, until we find the one we need
-	for (DslFile* fi = file; fi; fi = fi->next)
-	{
-		if (fi->langId == lang)
-			return fi;
-	}
+static std::optional<DslFile> find_file(lua_State* L)
+{
+	idstring name = to_idstring(L, 1);
+	idstring ext = to_idstring(L, 2);
 
-	// Can't find anything with the correct language
-	return nullptr;
+	// 3rd arg is an options table
+	idstring lang;
+	bool fallback = get_language(L, 3, &lang);
+	return DieselDB::Instance()->FindLocalized(name, ext, lang, fallback);
 }
 
 static int ldb_load(lua_State* L)
@@ -100,14 +108,45 @@ static int ldb_load(lua_State* L)
 
 	bool optional = false; // Is it valid for the file to not exist?
 
+	// Read large assets around the OS's file cache, for one-off reads that shouldn't evict the game's files
+	bool direct = false;
+
+	// If either of these are set, only read part of the file
+	bool ranged = false;
+	lua_Number offset = 0;
+	lua_Number length = -1;
+
 	if (lua_istable(L, 3))
 	{
 		lua_getfield(L, 3, "optional");
 		optional = lua_toboolean(L, -1);
 		lua_pop(L, 1);
+
+		lua_getfield(L, 3, "direct");
+		direct = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 3, "offset");
+		if (!lua_isnil(L, -1))
+		{
+			offset = luaL_checknumber(L, -1);
+			ranged = true;
+		}
+		lua_pop(L, 1);
+
+		lua_getfield(L, 3, "length");
+		if (!lua_isnil(L, -1))
+		{
+			length = luaL_checknumber(L, -1);
+			ranged = true;
+		}
+		lua_pop(L, 1);
+
+		if (offset < 0 || (ranged && length < -1))
+			luaL_error(L, "AssetDB: offset and length must not be negative");
 	}
 
-	DslFile* file = find_file(L);
+	std::optional<DslFile> file = find_file(L);
 
 	if (!file) // Asset does not exist
 	{
@@ -119,19 +158,34 @@ static int ldb_load(lua_State* L)
 
 		char msg[1024];
 		snprintf(msg, sizeof(msg) - 1, "AssetDB: could not load asset " IDPFP " - not found in database", name, ext);
-		luaL_error(L, msg);
+		luaL_error(L, "%s", msg);
 		return 0; // Placate CLion's null warning thing, luaL_error never returns
 	}
 
+	// Direct reads skip the asset cache too, since the whole point is not to keep the asset around
+	if (ranged || direct)
+	{
+		// A length of -1 (the default) reads to the end of the asset
+		char msg[1024];
+		try
+		{
+			uint64_t count = length < 0 ? ~(uint64_t)0 : (uint64_t)length;
+			std::vector<uint8_t> data = file->ReadRange((uint64_t)offset, count, direct);
+			lua_pushlstring(L, (const char*)data.data(), data.size());
+			return 1;
+		}
+		catch (const std::exception& ex)
+		{
+			snprintf(msg, sizeof(msg) - 1, "AssetDB: failed to read asset " IDPFP ": %s", name, ext, ex.what());
+		}
+		luaL_error(L, "%s", msg);
+	}
+
 	errno = 0;
 	try
 	{
-		std::ifstream fi;
-		fi.exceptions(std::ios::failbit);
-		fi.open(file->bundle->path, std::ios::binary);
-
-		std::vector<uint8_t> data = file->ReadContents(fi);
-		lua_pushlstring(L, (const char*)data.data(), data.size());
+		blt::db::AssetBuffer data = blt::db::AssetCache::Instance().Get(*file);
+		lua_pushlstring(L, (const char*)data->data(), data->size());
 		return 1;
 	}
 	catch (const std::ios::failure& ex)
@@ -141,19 +195,417 @@ static int ldb_load(lua_State* L)
 	}
 }
 
+// Arguments: name, ext, function(callback), optional table(options)
+// The callback is called with the contents of the asset, or nil and an error message if it couldn't be read.
+static int ldb_load_async(lua_State* L)
+{
+	idstring name = to_idstring(L, 1);
+	idstring ext = to_idstring(L, 2);
+
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	bool optional = false; // Is it valid for the file to not exist?
+	bool direct = false;   // Read around the OS's file cache, see ldb_load
+	if (lua_istable(L, 4))
+	{
+		lua_getfield(L, 4, "optional");
+		optional = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 4, "direct");
+		direct = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	idstring lang;
+	bool fallback = get_language(L, 4, &lang);
+
+	lua_pushvalue(L, 3);
+	int completion_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	// Both finding and reading the asset are done on the IO thread, since the former may involve loading the DB
+	dispatch_task([L, name, ext, lang, fallback, optional, direct, completion_func_ref]() {
+		blt::db::AssetBuffer data;
+		std::string error;
+
+		// Catch everything here, since an exception escaping the IO thread would take the game down with it
+		try
+		{
+			std::optional<DslFile> file = DieselDB::Instance()->FindLocalized(name, ext, lang, fallback);
+			if (!file)
+			{
+				// If the asset is optional, just pass nil without an error
+				if (!optional)
+				{
+					char msg[1024];
+					snprintf(msg, sizeof(msg) - 1, "AssetDB: could not load asset " IDPFP " - not found in database",
+					         name, ext);
+					error = msg;
+				}
+			}
+			else if (direct)
+			{
+				data = std::make_shared<const std::vector<uint8_t>>(file->ReadRange(0, ~(uint64_t)0, true));
+			}
+			else
+			{
+				errno = 0;
+				data = blt::db::AssetCache::Instance().Get(*file);
+			}
+		}
+		catch (const std::ios::failure& ex)
+		{
+			error = std::string("Failed to read bundle: io error: ") + strerror(errno);
+		}
+		catch (const std::exception& ex)
+		{
+			error = std::string("Failed to read bundle: ") + ex.what();
+		}
+
+		invoke_on_update(L, [L, func_ref{completion_func_ref}, data, error]() {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
+			if (data)
+			{
+				lua_pushlstring(L, (const char*)data->data(), data->size());
+				handled_pcall(L, 1, 0);
+			}
+			else if (error.empty())
+			{
+				lua_pushnil(L);
+				handled_pcall(L, 1, 0);
+			}
+			else
+			{
+				lua_pushnil(L);
+				lua_pushstring(L, error.c_str());
+				handled_pcall(L, 2, 0);
+			}
+			luaL_unref(L, LUA_REGISTRYINDEX, func_ref);
+		});
+	});
+
+	return 0;
+}
+
+// Parse a {name, ext} pair from a list of assets, which must be on the top of the stack
+static void get_list_entry(lua_State* L, int i, idstring* name, idstring* ext)
+{
+	if (!lua_istable(L, -1))
+		luaL_error(L, "AssetDB: entry %d in asset list is not a {name, ext} table", i);
+
+	lua_rawgeti(L, -1, 1);
+	*name = to_idstring(L, -1, "name");
+	lua_rawgeti(L, -2, 2);
+	*ext = to_idstring(L, -1, "ext");
+	lua_pop(L, 2);
+}
+
+static int ldb_load_many(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	bool optional = false; // Is it valid for the files to not exist?
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "optional");
+		optional = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	idstring lang;
+	bool fallback = get_language(L, 2, &lang);
+
+	// Look up all the files first, so we can read them in the most efficient order. Each entry in the list is
+	// a {name, ext} pair, and the results are stored at the same indexes in the table we return.
+	// Looking them up may raise a Lua error, which longjmps over destructors, so the results go into arrays
+	// owned by Lua rather than std::vectors. Don't hold on to the DB between lookups for the same reason.
+	int count = (int)lua_objlen(L, 1);
+	DslFile* found = (DslFile*)lua_newuserdata(L, count * sizeof(DslFile));
+	int* foundIndexes = (int*)lua_newuserdata(L, count * sizeof(int));
+	int foundCount = 0;
+	for (int i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 1, i);
+		idstring name, ext;
+		get_list_entry(L, i, &name, &ext);
+		lua_pop(L, 1);
+
+		std::optional<DslFile> file = DieselDB::Instance()->FindLocalized(name, ext, lang, fallback);
+		if (!file)
+		{
+			if (optional)
+				continue;
+
+			char msg[1024];
+			snprintf(msg, sizeof(msg) - 1, "AssetDB: could not load asset " IDPFP " - not found in database", name,
+			         ext);
+			luaL_error(L, "%s", msg);
+		}
+
+		found[foundCount] = *file;
+		foundIndexes[foundCount] = i;
+		foundCount++;
+	}
+
+	lua_createtable(L, count, 0);
+
+	// Don't raise a Lua error until the vectors and the try block are gone, since that longjmps over the
+	// destructors
+	char error[1024] = {0};
+	{
+		std::vector<DslFile> files(found, found + foundCount);
+		errno = 0;
+		try
+		{
+			blt::db::ReadFiles(files, [&](size_t index, const uint8_t* data, size_t length) {
+				lua_pushlstring(L, (const char*)data, length);
+				lua_rawseti(L, -2, foundIndexes[index]);
+			});
+		}
+		catch (const std::ios::failure& ex)
+		{
+			snprintf(error, sizeof(error) - 1, "Failed to read bundle: io error: %s", strerror(errno));
+		}
+		catch (const std::exception& ex)
+		{
+			snprintf(error, sizeof(error) - 1, "Failed to read bundle: %s", ex.what());
+		}
+	}
+
+	if (error[0])
+		luaL_error(L, "%s", error);
+
+	return 1;
+}
+
+// Build the list of file ranges to prefetch (or check the status of) from the list in the first argument. Each
+// entry may be an {name, ext} pair for an asset, or the path to a file such as a mod's custom asset.
+static std::vector<blt::db::PrefetchRange> get_prefetch_ranges(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	idstring lang;
+	bool fallback = get_language(L, 2, &lang);
+
+	std::vector<blt::db::PrefetchRange> ranges;
+	int count = (int)lua_objlen(L, 1);
+	for (int i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 1, i);
+		if (lua_type(L, -1) == LUA_TSTRING)
+		{
+			ranges.push_back(blt::db::PrefetchRange::OfWholeFile(lua_tostring(L, -1)));
+		}
+		else
+		{
+			idstring name, ext;
+			get_list_entry(L, i, &name, &ext);
+
+			// Missing assets are ignored, since there's nothing to prefetch
+			std::optional<DslFile> file = DieselDB::Instance()->FindLocalized(name, ext, lang, fallback);
+			if (file && file->Found())
+				ranges.push_back(blt::db::PrefetchRange::OfFile(*file));
+		}
+		lua_pop(L, 1);
+	}
+
+	return ranges;
+}
+
+// Arguments: table(list) optional table(options)
+// Returns the number of entries that will be prefetched
+static int ldb_prefetch(lua_State* L)
+{
+	std::vector<blt::db::PrefetchRange> ranges = get_prefetch_ranges(L);
+	lua_pushinteger(L, (lua_Integer)ranges.size());
+	blt::db::Prefetch(std::move(ranges));
+	return 1;
+}
+
+// Arguments: table(list) optional table(options)
+// Returns a table with the number of prefetches still running, and how many of the bytes of the listed assets
+// are already in memory - the latter is nil if that isn't supported on this platform.
+static int ldb_prefetch_status(lua_State* L)
+{
+	std::vector<blt::db::PrefetchRange> ranges = get_prefetch_ranges(L);
+
+	bool supported = true;
+	blt::db::Residency total{0, 0};
+	for (const blt::db::PrefetchRange& range : ranges)
+	{
+		std::optional<blt::db::Residency> residency = blt::db::QueryResidency(range);
+		if (!residency)
+		{
+			supported = false;
+			break;
+		}
+
+		total.resident += residency->resident;
+		total.total += residency->total;
+	}
+
+	lua_createtable(L, 0, 3);
+	lua_pushinteger(L, (lua_Integer)blt::db::PendingPrefetches());
+	lua_setfield(L, -2, "pending");
+	if (supported)
+	{
+		lua_pushnumber(L, (lua_Number)total.resident);
+		lua_setfield(L, -2, "resident");
+		lua_pushnumber(L, (lua_Number)total.total);
+		lua_setfield(L, -2, "total");
+	}
+	return 1;
+}
+
+static const char* QUERY_METATABLE = "SBLT.AssetQuery";
+
+static void push_idstring(lua_State* L, idstring value)
+{
+	// Use the raw hash form, which to_idstring accepts
+	char str[32];
+	snprintf(str, sizeof(str), "#" IDPF, value);
+	lua_pushstring(L, str);
+}
+
+static int ldb_query_gc(lua_State* L)
+{
+	// This releases the query's reference to the DB, which might be an old version that's since been reloaded
+	auto* query = (blt::db::AssetQuery*)luaL_checkudata(L, 1, QUERY_METATABLE);
+	query->~AssetQuery();
+	return 0;
+}
+
+// Upvalue 1 is the userdata holding the query
+static int ldb_list_next(lua_State* L)
+{
+	auto* query = (blt::db::AssetQuery*)lua_touserdata(L, lua_upvalueindex(1));
+
+	std::optional<DslFile> file = query->Next();
+	if (!file)
+		return 0;
+
+	push_idstring(L, file->name);
+	push_idstring(L, file->type);
+	if (file->langId)
+		push_idstring(L, file->langId);
+	else
+		lua_pushnil(L);
+	return 3;
+}
+
+// Arguments: optional table(filter), with any of the name, type, bundle and language fields
+// Returns an iterator over the name, ext and language (or nil) of each matching asset, for use in a for loop
+static int ldb_list(lua_State* L)
+{
+	blt::db::AssetQuery::Filter filter;
+	const char* bundleName = nullptr;
+	if (lua_istable(L, 1))
+	{
+		lua_getfield(L, 1, "name");
+		if (!lua_isnil(L, -1))
+			filter.name = to_idstring(L, -1, "filter.name");
+		lua_pop(L, 1);
+
+		lua_getfield(L, 1, "type");
+		if (!lua_isnil(L, -1))
+			filter.type = to_idstring(L, -1, "filter.type");
+		lua_pop(L, 1);
+
+		lua_getfield(L, 1, "language");
+		if (!lua_isnil(L, -1))
+			filter.language = to_idstring(L, -1, "filter.language");
+		lua_pop(L, 1);
+
+		// This is left on the stack, so the string stays valid
+		lua_getfield(L, 1, "bundle");
+		if (!lua_isnil(L, -1))
+			bundleName = luaL_checkstring(L, -1);
+	}
+
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	if (bundleName)
+	{
+		filter.bundle = db->FindBundle(bundleName);
+		if (!filter.bundle)
+		{
+			// luaL_error doesn't run destructors, so release the DB first
+			db.reset();
+			luaL_error(L, "AssetDB: no such bundle '%s'", bundleName);
+		}
+	}
+
+	// The query holds the reference to the DB now, which is released by it's __gc method
+	void* query = lua_newuserdata(L, sizeof(blt::db::AssetQuery));
+	new (query) blt::db::AssetQuery(std::move(db), filter);
+	if (luaL_newmetatable(L, QUERY_METATABLE))
+	{
+		lua_pushcfunction(L, ldb_query_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	lua_pushcclosure(L, ldb_list_next, 1);
+	return 1;
+}
+
 static int ldb_has(lua_State* L)
 {
-	DslFile* file = find_file(L);
-	lua_pushboolean(L, file != nullptr);
+	std::optional<DslFile> file = find_file(L);
+	lua_pushboolean(L, file.has_value());
+	return 1;
+}
+
+static int ldb_cache_stats(lua_State* L)
+{
+	blt::db::AssetCache::Stats stats = blt::db::AssetCache::Instance().GetStats();
+
+	lua_createtable(L, 0, 5);
+	lua_pushnumber(L, (lua_Number)stats.hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushnumber(L, (lua_Number)stats.misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushnumber(L, (lua_Number)stats.size);
+	lua_setfield(L, -2, "size");
+	lua_pushnumber(L, (lua_Number)stats.count);
+	lua_setfield(L, -2, "count");
+	lua_pushnumber(L, (lua_Number)stats.capacity);
+	lua_setfield(L, -2, "capacity");
 	return 1;
 }
 
+static int ldb_set_cache_capacity(lua_State* L)
+{
+	lua_Number bytes = luaL_checknumber(L, 1);
+	if (bytes < 0)
+		luaL_error(L, "AssetDB: cache capacity must not be negative");
+
+	blt::db::AssetCache::Instance().SetCapacity((size_t)bytes);
+	return 0;
+}
+
+// Arguments: boolean(enabled)
+// Turns recording which assets the game opens on or off, so they can be prefetched next time (see AccessTrace)
+static int ldb_set_trace_enabled(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TBOOLEAN);
+	blt::db::AccessTrace::Instance().SetEnabled(lua_toboolean(L, 1));
+	return 0;
+}
+
 void load_lua_asset_db(lua_State* L)
 {
 	// (note: ldb = Lua asset DB)
 	luaL_Reg vmLib[] = {
 		{"read_file", ldb_load},
+		{"read_files", ldb_load_many},
+		{"read_file_async", ldb_load_async},
+		{"prefetch", ldb_prefetch},
+		{"prefetch_status", ldb_prefetch_status},
 		{"has_file", ldb_has},
+		{"list", ldb_list},
+		{"cache_stats", ldb_cache_stats},
+		{"set_cache_capacity", ldb_set_cache_capacity},
+		{"set_trace_enabled", ldb_set_trace_enabled},
 
 		{nullptr, nullptr},
 	};
@@ -41,7 +41,7 @@ static int thread_count;
 PD2HOOK_REGISTER_EVENTQUEUE(IOCompletion, Completions);
 
 // TODO deduplicate with that in InitiateState
-static void handled_pcall(lua_State* L, int nargs, int nresults)
+void handled_pcall(lua_State* L, int nargs, int nresults)
 {
 	int err = lua_pcall(L, nargs, nresults, 0);
 	if (err == LUA_ERRRUN)
@@ -52,7 +52,7 @@ static void handled_pcall(lua_State* L, int nargs, int nresults)
 	}
 }
 
-static void invoke_on_update(lua_State* L, std::function<void()> func)
+void invoke_on_update(lua_State* L, std::function<void()> func)
 {
 	IOCompletion completion{L, std::move(func)};
 
@@ -130,7 +130,7 @@ static void dispatch_task(IOTask&& task)
 	condition_var.notify_one();
 }
 
-static void dispatch_task(std::function<void()> func)
+void dispatch_task(std::function<void()> func)
 {
 	IOTask task{};
 	task.func = std::move(func);
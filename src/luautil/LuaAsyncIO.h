@@ -6,4 +6,15 @@
 
 #include <lua.h>
 
+#include <functional>
+
 void load_lua_async_io(lua_State* L);
+
+// Run a function on one of the async IO threads
+void dispatch_task(std::function<void()> func);
+
+// Run a function on the main thread during the next update. It's dropped if the Lua state has been closed by then.
+void invoke_on_update(lua_State* L, std::function<void()> func);
+
+// Call a function with lua_pcall, logging and popping the error message if it fails
+void handled_pcall(lua_State* L, int nargs, int nresults);
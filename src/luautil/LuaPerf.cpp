@@ -0,0 +1,76 @@
+#include "LuaPerf.h"
+
+#include <dbutil/IoStats.h>
+#include <platform.h>
+
+using blt::db::IoSource;
+using blt::db::IoStats;
+
+static int lperf_io_stats(lua_State* L)
+{
+	IoStats& stats = IoStats::Instance();
+
+	lua_createtable(L, 0, 1 + blt::db::IO_SOURCE_COUNT);
+	lua_pushboolean(L, stats.IsEnabled());
+	lua_setfield(L, -2, "enabled");
+
+	for (size_t i = 0; i < blt::db::IO_SOURCE_COUNT; i++)
+	{
+		IoStats::Counters c = stats.Get((IoSource)i);
+
+		lua_createtable(L, 0, 7);
+		lua_pushnumber(L, (lua_Number)c.opens);
+		lua_setfield(L, -2, "opens");
+		lua_pushnumber(L, (lua_Number)c.reads);
+		lua_setfield(L, -2, "reads");
+		lua_pushnumber(L, (lua_Number)c.bytes);
+		lua_setfield(L, -2, "bytes");
+		lua_pushnumber(L, (lua_Number)(c.nanos / 1e6));
+		lua_setfield(L, -2, "total_ms");
+		lua_pushnumber(L, (lua_Number)(c.Percentile(0.5) / 1e3));
+		lua_setfield(L, -2, "p50_us");
+		lua_pushnumber(L, (lua_Number)(c.Percentile(0.99) / 1e3));
+		lua_setfield(L, -2, "p99_us");
+
+		// Entry i (counting from one, as Lua does) is the number of reads which took under 2^(i+7) ns, with the
+		// last entry counting the rest
+		lua_createtable(L, IoStats::HISTOGRAM_BUCKETS, 0);
+		for (size_t bucket = 0; bucket < IoStats::HISTOGRAM_BUCKETS; bucket++)
+		{
+			lua_pushnumber(L, (lua_Number)c.histogram[bucket]);
+			lua_rawseti(L, -2, (int)bucket + 1);
+		}
+		lua_setfield(L, -2, "histogram");
+
+		lua_setfield(L, -2, blt::db::IoSourceName((IoSource)i));
+	}
+
+	return 1;
+}
+
+static int lperf_set_io_stats_enabled(lua_State* L)
+{
+	IoStats::Instance().SetEnabled(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int lperf_reset_io_stats(lua_State* L)
+{
+	IoStats::Instance().Reset();
+	return 0;
+}
+
+void load_lua_perf(lua_State* L)
+{
+	luaL_Reg vmLib[] = {
+		{"io_stats", lperf_io_stats},
+		{"set_io_stats_enabled", lperf_set_io_stats_enabled},
+		{"reset_io_stats", lperf_reset_io_stats},
+
+		{nullptr, nullptr},
+	};
+
+	lua_newtable(L);
+	luaL_openlib(L, nullptr, vmLib, 0);
+	lua_setfield(L, -2, "perf");
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <lua.h>
+
+void load_lua_perf(lua_State* L);
@@ -40,6 +40,18 @@ namespace pd2hook::scriptdata::tools
 		main = &stream;
 	}
 
+	void writePtr(buffer_writer &out, bool is32bit, uint32_t val)
+	{
+		if(is32bit)
+		{
+			writeVal<uint32_t>(out, val);
+		}
+		else
+		{
+			writeVal<uint64_t>(out, val);
+		}
+	}
+
 	void writePtr(write_block &out, bool is32bit, uint32_t val)
 	{
 		if(is32bit)
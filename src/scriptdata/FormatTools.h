@@ -5,6 +5,10 @@
 #include <memory>
 #include <functional>
 
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
 namespace pd2hook::scriptdata::tools
 {
 	// Represents a single block of data to be written somewhere in the file
@@ -50,6 +54,39 @@ namespace pd2hook::scriptdata::tools
 		linkage(write_block *block, on_address_set_t cb) : block(block), on_address_set(cb) {}
 	};
 
+	// Writes values into part of a buffer that has already been sized to fit them, so there's nothing to grow or
+	// patch up afterwards
+	class buffer_writer
+	{
+	public:
+		buffer_writer(uint8_t *data, size_t size, uint32_t pos) : data(data), size(size), pos(pos) {}
+
+		void write(const void *src, size_t length)
+		{
+			assert(pos + length <= size);
+			memcpy(data + pos, src, length);
+			pos += length;
+		}
+
+		inline uint32_t tellp() const
+		{
+			return pos;
+		}
+
+	private:
+		uint8_t *data;
+		size_t size;
+		uint32_t pos;
+	};
+
+	template<typename T>
+	void writeVal(buffer_writer &out, T val)
+	{
+		out.write(&val, sizeof(val));
+	}
+
+	void writePtr(buffer_writer &out, bool is32bit, uint32_t val);
+
 	template<typename T>
 	void writeVal(write_block &out, T val)
 	{
@@ -4,13 +4,12 @@
 #include <cassert>
 
 // For the writer
-#include <sstream>
 #include <algorithm>
 #include <functional>
+#include <iterator>
 #include <memory>
-
-// Testing
-#include <chrono>
+#include <stdexcept>
+#include <unordered_map>
 
 #include "util/util.h"
 
@@ -285,8 +284,11 @@ namespace pd2hook::scriptdata
 
 	// WRITING
 
-	using std::ostream;
-
+	// The output is laid out in two passes: first the size and position of every part of the file is worked out,
+	// then everything is written straight into a buffer of exactly the right size. The parts are, in order:
+	//  - The header: the allocator, the vector of each type of item, and the reference to the root item
+	//  - The contents of each of those vectors, in the same order, where each string's text follows the vector
+	//    of strings, and each table's contents follows the vector of tables
 	class SItem::write_info
 	{
 	public:
@@ -294,7 +296,7 @@ namespace pd2hook::scriptdata
 		{
 			if(added) *added = false;
 
-			std::map<const SItem*, int> &oftype_indexes = item_positions[item->GetId()];
+			std::unordered_map<const SItem*, int> &oftype_indexes = item_positions[item->GetId()];
 
 			auto existing_idx = oftype_indexes.find(item);
 			if (existing_idx != oftype_indexes.end()) {
@@ -323,8 +325,6 @@ namespace pd2hook::scriptdata
 		void freeze()
 		{
 			frozen = true;
-			blocks.clear();
-			linkages.clear();
 		}
 
 		inline bool is32bit()
@@ -335,59 +335,25 @@ namespace pd2hook::scriptdata
 		explicit write_info(bool use32bit) : use32bit(use32bit) {}
 		write_info(write_info&) = delete;
 
-		write_block& create_block()
-		{
-			if(blocks_applied)
-			{
-				throw "cannot create blocks after they are applied";
-			}
+		// Where the text of the next string goes, which is moved along as each string is written
+		uint32_t string_data = 0;
 
-			write_block *block = new write_block();
+		// Where the contents of the next table goes, the same as string_data
+		uint32_t table_data = 0;
 
-			blocks.push_back(std::unique_ptr<write_block>(block));
-
-			return *blocks.back();
-		}
-
-		void create_linkage(write_block &block, linkage::on_address_set_t cb)
-		{
-			linkage lk = linkage(&block, cb);
-			linkages.push_back(std::move(lk));
-		}
-
-		void apply_blocks(ostream &out)
-		{
-			blocks_applied = true;
-
-			for(const std::unique_ptr<write_block> &block : blocks)
-			{
-				block->write_to(out);
-			}
-
-			// TODO linkages
-			for(const linkage& ln : linkages)
-			{
-				ln.on_address_set(ln.block->offset);
-			}
-		}
-
-		const std::map<int, std::vector<const SItem*>> &Items()
-		{
-			return items;
-		}
+		// The buffer everything is written into, and it's size
+		uint8_t *buffer = nullptr;
+		size_t buffer_size = 0;
 
 	private:
 		std::map<int, std::vector<const SItem*>> items;
-		std::map<int, std::map<const SItem*, int>> item_positions;
-		std::vector<std::unique_ptr<write_block>> blocks;
-		std::vector<linkage> linkages;
+		std::map<int, std::unordered_map<const SItem*, int>> item_positions;
 
 		bool frozen = false;
-		bool blocks_applied = false;
 		bool use32bit = false;
 	};
 
-	static void writeRef(write_block &out, SItem::write_info *info, const SItem *item)
+	static void writeRef(buffer_writer &out, SItem::write_info *info, const SItem *item)
 	{
 		switch(item->GetId())
 		{
@@ -405,50 +371,8 @@ namespace pd2hook::scriptdata
 
 	std::string SItem::Serialise(bool use32bit) const
 	{
-		auto serialise_vector = [] (write_block &out, SItem::write_info &data, int id)
-		{
-			const std::vector<const SItem*> &items = data.ListOf(id);
-
-			// contents vector
-			uint32_t count = items.size(); // 0xEFBEADDE;
-			writeVal<uint32_t>(out, count); // count
-			writeVal<uint32_t>(out, count); // capacity
-
-			bool is32 = data.is32bit();
-
-			// Write the contents pointer, which gets overwritten with the address of the contents block
-			uint32_t pos = out.tellp();
-			write_block &contents = data.create_block();
-			data.create_linkage(contents, [is32, &out, pos](uint32_t offset)
-			{
-				out.seek(pos);
-				writePtr(out, is32, offset);
-			});
-			writePtr(out, is32, 0); // contents
-
-			writePtr(out, is32, 0 /* 0xDEADBEEF */); // allocator (overwritten, value doesn't matter for PD2, tool thinks it's 32-bit if this is zero, so write an easily identifiable value here)
-
-			// Write out the contents
-			for(const SItem* item : items)
-			{
-				item->Serialise(contents, data);
-			}
-		};
-
-		//PD2HOOK_LOG_LOG("S:0");
-		auto timer = std::chrono::high_resolution_clock::now();
-		auto printtime = [&timer](std::string name) {
-			auto now = std::chrono::high_resolution_clock::now();
-			long time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - timer).count();
-			std::string str = name + " : " + std::to_string(time_ms);
-			//PD2HOOK_LOG_LOG(str.c_str());
-			timer = now;
-		};
-
 		write_info data(use32bit);
 
-		printtime("S:1");
-
 		// Explore the dependency tree between objects, to make sure we've found everything
 		Register([&data](const SItem *item) {
 			bool added;
@@ -456,58 +380,99 @@ namespace pd2hook::scriptdata
 			return added;
 		});
 
-		printtime("S:2");
-
 		// Freeze them while serialising
 		data.freeze();
 
-		// Make sure we create the first block after freezing, otherwise it would be removed and be invalid
-		write_block &out = data.create_block();
+		// First pass: work out where each part of the file goes
+		const size_t ptr_size = use32bit ? 4 : 8;
+		const size_t vec_size = 8 + 2 * ptr_size; // count, capacity, contents and allocator
 
-		// Allocator pointer
-		// Written over during loading, afaik we can put anything here
-		writePtr(out, use32bit, 0);
+		static_assert(sizeof(float) == 4, "incompatible float size");
+		const int vector_types[] = { SNum::ID, SString::ID, SVector::ID, SQuaternion::ID, SIdstring::ID, STable::ID };
+		auto item_size = [ptr_size, vec_size](int id) -> size_t
+		{
+			switch(id)
+			{
+			case SNum::ID: return 4;
+			case SString::ID: return 2 * ptr_size; // allocator and text
+			case SVector::ID: return 12;
+			case SQuaternion::ID: return 16;
+			case SIdstring::ID: return 8;
+			case STable::ID: return ptr_size + vec_size; // meta and contents
+			default: throw std::exception();
+			}
+		};
 
-		printtime("S:3");
+		size_t size = ptr_size + std::size(vector_types) * vec_size + 4;
+		std::map<int, uint32_t> contents_offsets;
+		size_t strings_end = 0;
+		for(int id : vector_types)
+		{
+			contents_offsets[id] = size;
+			size += data.ListOf(id).size() * item_size(id);
 
-		static_assert(sizeof(float) == 4, "incompatible float size");
-		// Write float array
-		serialise_vector(out, data, SNum::ID);
+			if(id == SString::ID)
+			{
+				data.string_data = size;
+				for(const SItem *item : data.ListOf(id))
+					size += ((const SString*) item)->val.size() + 1;
+				strings_end = size;
+			}
+			else if(id == STable::ID)
+			{
+				data.table_data = size;
+				for(const SItem *item : data.ListOf(id))
+					size += ((const STable*) item)->items.size() * 8;
+			}
+		}
+
+		if(size > UINT32_MAX)
+			throw std::length_error("ScriptData too large to serialise");
 
-		// Write string array
-		serialise_vector(out, data, SString::ID);
+		// Second pass: write everything into place
+		std::string result(size, '\0');
+		data.buffer = (uint8_t*) &result[0];
+		data.buffer_size = size;
+		buffer_writer out(data.buffer, size, 0);
+
+		// Allocator pointer
+		// Written over during loading, afaik we can put anything here
+		writePtr(out, use32bit, 0);
 
-		// Write vector array
-		serialise_vector(out, data, SVector::ID);
+		for(int id : vector_types)
+		{
+			const std::vector<const SItem*> &items = data.ListOf(id);
 
-		// Write quaternion array
-		serialise_vector(out, data, SQuaternion::ID);
+			uint32_t count = items.size();
+			writeVal<uint32_t>(out, count); // count
+			writeVal<uint32_t>(out, count); // capacity
+			writePtr(out, use32bit, contents_offsets[id]); // contents
 
-		// Write idstring array
-		serialise_vector(out, data, SIdstring::ID);
+			writePtr(out, use32bit, 0 /* 0xDEADBEEF */); // allocator (overwritten, value doesn't matter for PD2, tool thinks it's 32-bit if this is zero, so write an easily identifiable value here)
 
-		// Write table array
-		serialise_vector(out, data, STable::ID);
+			buffer_writer contents(data.buffer, size, contents_offsets[id]);
+			for(const SItem* item : items)
+			{
+				item->Serialise(contents, data);
+			}
+		}
 
 		// Write reference to initial item
 		writeRef(out, &data, this);
 
-		printtime("S:4");
-
-		std::stringstream outstream;
-		data.apply_blocks(outstream);
-
-		printtime("S:5");
+		// Everything should have exactly filled it's space
+		assert(data.string_data == strings_end);
+		assert(data.table_data == size);
 
-		return outstream.str();
+		return result;
 	}
 
-	void SNum::Serialise(write_block &out, write_info &info) const
+	void SNum::Serialise(buffer_writer &out, write_info &info) const
 	{
 		writeVal<float>(out, val);
 	}
 
-	void SString::Serialise(write_block &out, write_info &info) const
+	void SString::Serialise(buffer_writer &out, write_info &info) const
 	{
 		bool is32 = info.is32bit();
 
@@ -515,28 +480,21 @@ namespace pd2hook::scriptdata
 		// as above, we should avoid zero here (though it probably doesn't really matter)
 		writePtr(out, is32, 0 /* 0xDEADBEEF */);
 
-		write_block &blk = info.create_block();
-		uint32_t pos = out.tellp();
-		info.create_linkage(blk, [is32, &out, pos](uint32_t offset)
-		{
-			out.seek(pos);
-			writePtr(out, is32, offset);
-		});
-
-		// Write zero for the string offset for now, we'll overwrite this with the block as per above
-		writePtr(out, info.is32bit(), 0);
-
-		blk.stream() << val << ((char)0);
+		// The text, including it's null terminator, goes after all the other strings' text
+		writePtr(out, is32, info.string_data);
+		buffer_writer text(info.buffer, info.buffer_size, info.string_data);
+		text.write(val.c_str(), val.size() + 1);
+		info.string_data = text.tellp();
 	}
 
-	void SVector::Serialise(write_block &out, write_info &info) const
+	void SVector::Serialise(buffer_writer &out, write_info &info) const
 	{
 		writeVal<float>(out, x);
 		writeVal<float>(out, y);
 		writeVal<float>(out, z);
 	}
 
-	void SQuaternion::Serialise(write_block &out, write_info &info) const
+	void SQuaternion::Serialise(buffer_writer &out, write_info &info) const
 	{
 		writeVal<float>(out, x);
 		writeVal<float>(out, y);
@@ -544,12 +502,12 @@ namespace pd2hook::scriptdata
 		writeVal<float>(out, w);
 	}
 
-	void SIdstring::Serialise(write_block &out, write_info &info) const
+	void SIdstring::Serialise(buffer_writer &out, write_info &info) const
 	{
 		writeVal<uint64_t>(out, val);
 	}
 
-	void STable::Serialise(write_block &out, write_info &info) const
+	void STable::Serialise(buffer_writer &out, write_info &info) const
 	{
 		bool is32 = info.is32bit();
 
@@ -559,29 +517,22 @@ namespace pd2hook::scriptdata
 		else
 			writePtr(out, is32, 0xFFFFFFFF);
 
-		// contents vector
+		// contents vector, which goes after all the other tables' contents
 		uint32_t count = items.size();
 		writeVal<uint32_t>(out, count); // count
 		writeVal<uint32_t>(out, count); // capacity
-
-		// Write the contents pointer, which gets overwritten with the address of the contents block
-		write_block &contents = info.create_block();
-		uint32_t pos = out.tellp();
-		info.create_linkage(contents, [is32, &out, pos](uint32_t offset)
-		{
-			out.seek(pos);
-			writePtr(out, is32, offset);
-		});
-		writePtr(out, is32, 0); // contents
+		writePtr(out, is32, info.table_data); // contents
 
 		writePtr(out, is32, 0 /*0xDEADBEEF*/ ); // allocator - see earlier uses for a comment of this
 
 		// Write out the contents
+		buffer_writer contents(info.buffer, info.buffer_size, info.table_data);
 		for(std::pair<const SItem*, const SItem*> pair : items)
 		{
 			writeRef(contents, &info, pair.first);
 			writeRef(contents, &info, pair.second);
 		}
+		info.table_data = contents.tellp();
 	}
 
 	void STable::Register(RegReceiver receiver) const
@@ -33,7 +33,7 @@ namespace pd2hook::scriptdata
 			receiver(this);
 		};
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const = 0;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const = 0;
 	};
 
 	class SNil : public SItem
@@ -47,7 +47,7 @@ namespace pd2hook::scriptdata
 		static const SNil INSTANCE;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override
 		{
 			throw std::exception();
 		};
@@ -71,7 +71,7 @@ namespace pd2hook::scriptdata
 		static const SBool SFALSE;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override
 		{
 			throw std::exception();
 		};
@@ -92,7 +92,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 3;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 	};
 
 	class SString : public SItem
@@ -115,7 +115,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 4;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 	};
 
 	class SVector : public SItem
@@ -133,7 +133,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 5;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 	};
 
 	class SQuaternion : public SItem
@@ -151,7 +151,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 6;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 	};
 
 	class SIdstring : public SItem
@@ -169,7 +169,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 7;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 	};
 
 	class STable : public SItem
@@ -186,7 +186,7 @@ namespace pd2hook::scriptdata
 		static const int ID = 8;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(tools::buffer_writer &out, write_info &info) const override;
 		virtual void Register(RegReceiver receiver) const override;
 	};
 
@@ -6,7 +6,11 @@
 #include "wrenloader.h"
 #include "xmltweaker_internal.h"
 
+#include <dbutil/AssetCache.h>
+#include <dbutil/AssetQuery.h>
 #include <dbutil/DB.h>
+#include <dbutil/IoStats.h>
+#include <dbutil/Prefetch.h>
 #include <platform.h>
 #include <util/util.h>
 
@@ -18,6 +22,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 using blt::db::DieselDB;
 using blt::db::DslFile;
@@ -26,6 +31,9 @@ static const char* MODULE = "base/native/DB_001";
 
 static void wrenRegisterAssetHook(WrenVM* vm);
 static void wrenLoadAssetContents(WrenVM* vm);
+static void wrenLoadAssetContentsDirect(WrenVM* vm);
+static void wrenPrefetch(WrenVM* vm);
+static void wrenListAssetsChunk(WrenVM* vm);
 
 class DBTargetFile
 {
@@ -44,6 +52,9 @@ class DBTargetFile
 	/** The handle to a Wren object to run the loading callback on */
 	WrenHandle* wren_loader_obj = nullptr;
 
+	/** How the datastore given to the engine reads the file or bundle. This isn't reset by clear_sources. */
+	blt::db::ReadMode read_mode = blt::db::ReadMode::Default;
+
 	explicit DBTargetFile(blt::idfile id) : id(id)
 	{
 	}
@@ -68,10 +79,13 @@ class DBForeignFile
 	uint64_t magic;
 	static const uint64_t MAGIC_COOKIE = 0xb4cb844461d94c07; // random value
 
-	// Note: use unique_ptrs here for strings since our destructor won't be called, so otherwise they could leak
+	// Note: use smart pointers here for strings since our destructor won't be called, so otherwise they could leak
 	std::unique_ptr<std::string> filename;
 	blt::idfile asset;
-	std::unique_ptr<std::string> stringLiteral;
+
+	// The contents passed to from_string. These are shared with the datastores handed to the engine, rather than
+	// copied each time the asset is loaded.
+	blt::db::AssetBuffer stringLiteral;
 
 	static void ofFile(WrenVM* vm);
 	static void ofAsset(WrenVM* vm);
@@ -101,6 +115,8 @@ class DBAssetHook
 	static void setDirectBundle(WrenVM* vm);
 	static void getWrenLoader(WrenVM* vm);
 	static void setWrenLoader(WrenVM* vm);
+	static void getReadMode(WrenVM* vm);
+	static void setReadMode(WrenVM* vm);
 
 	std::shared_ptr<DBTargetFile> file;
 
@@ -125,10 +141,23 @@ WrenForeignMethodFn pd2hook::tweaker::dbhook::bind_dbhook_method(WrenVM* vm, con
 		{
 			return wrenRegisterAssetHook;
 		}
-		else if (signature == "load_asset_contents(_,_)")
+		else if (signature == "load_asset_contents(_,_)" || signature == "load_asset_contents(_,_,_)" ||
+		         signature == "load_asset_contents(_,_,_,_)")
 		{
 			return wrenLoadAssetContents;
 		}
+		else if (signature == "load_asset_contents_direct(_,_)")
+		{
+			return wrenLoadAssetContentsDirect;
+		}
+		else if (signature == "prefetch(_)")
+		{
+			return wrenPrefetch;
+		}
+		else if (signature == "list_assets_chunk_(_,_,_,_,_)")
+		{
+			return wrenListAssetsChunk;
+		}
 	}
 	else if (class_name == "DBAssetHook" && !is_static)
 	{
@@ -154,6 +183,10 @@ WrenForeignMethodFn pd2hook::tweaker::dbhook::bind_dbhook_method(WrenVM* vm, con
 			return &DBAssetHook::getWrenLoader;
 		else if (signature == "wren_loader=(_)")
 			return &DBAssetHook::setWrenLoader;
+		else if (signature == "read_mode")
+			return &DBAssetHook::getReadMode;
+		else if (signature == "read_mode=(_)")
+			return &DBAssetHook::setReadMode;
 	}
 	else if (class_name == "DBForeignFile" && is_static)
 	{
@@ -252,35 +285,82 @@ static void wrenRegisterAssetHook(WrenVM* vm)
 	hook->magic = DBAssetHook::MAGIC_COOKIE;
 }
 
+// The largest integer a Wren number (a double) can hold exactly
+static const double MAX_SAFE_WREN_INTEGER = 9007199254740992.0;
+
 static void wrenLoadAssetContents(WrenVM* vm)
 {
 	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
 	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
 
-	DslFile* file = DieselDB::Instance()->Find(name, ext);
+	// Check the offset and length before converting them, since a negative number (or something that isn't a
+	// number at all) would otherwise turn into some arbitrary huge range
+	bool ranged = wrenGetSlotCount(vm) == 5;
+	uint64_t offset = 0, length = 0;
+	if (ranged)
+	{
+		double values[2] = {-1, -1};
+		for (int i = 0; i < 2; i++)
+		{
+			if (wrenGetSlotType(vm, 3 + i) == WREN_TYPE_NUM)
+				values[i] = wrenGetSlotDouble(vm, 3 + i);
+		}
+
+		// This also catches NaN, since any comparison with it is false
+		auto valid = [](double value) { return value >= 0 && value <= MAX_SAFE_WREN_INTEGER; };
+		if (!valid(values[0]) || !valid(values[1]))
+		{
+			wrenSetSlotString(vm, 0, "DBManager.load_asset_contents: offset and length must be non-negative numbers");
+			wrenAbortFiber(vm, 0);
+			return;
+		}
 
-	if (file == nullptr)
+		offset = (uint64_t)values[0];
+		length = (uint64_t)values[1];
+	}
+
+	// This is shared with the overloads taking a language, which falls back to the language-less and English
+	// versions of the asset if necessary, and taking an offset and length to only read part of the asset.
+	std::optional<DslFile> file;
+	if (wrenGetSlotCount(vm) == 4)
+	{
+		if (wrenGetSlotType(vm, 3) != WREN_TYPE_STRING)
+		{
+			wrenSetSlotString(vm, 0, "DBManager.load_asset_contents: language must be a string");
+			wrenAbortFiber(vm, 0);
+			return;
+		}
+
+		file = DieselDB::Instance()->FindLocalized(name, ext, parseHash(wrenGetSlotString(vm, 3)));
+	}
+	else
+		file = DieselDB::Instance()->Find(name, ext);
+
+	if (!file)
 	{
 		wrenSetSlotNull(vm, 0);
 		return;
 	}
 
-	if (!file->HasLength() || !file->Found())
+	if (ranged)
 	{
-		wrenSetSlotString(vm, 0, "Failed to read bundle file, bundle or length not set? Please report to SBLT");
-		wrenAbortFiber(vm, 0);
+		try
+		{
+			std::vector<uint8_t> data = file->ReadRange(offset, length);
+			wrenSetSlotBytes(vm, 0, (const char*)data.data(), data.size());
+		}
+		catch (const std::exception& ex)
+		{
+			std::string msg = std::string("Failed to read part of asset - ") + ex.what();
+			wrenSetSlotString(vm, 0, msg.c_str());
+			wrenAbortFiber(vm, 0);
+		}
 		return;
 	}
 
-	// Ahh yes, be sure to enable binary mode
-	// Otherwise stream.read will fail on Windows with failbit set, and won't touch errno
-	// I think I'm getting better at tracking this exact same problem down - this time, it only wasted a
-	// few perfectly good hours of my time.
-	std::ifstream stream(file->bundle->path, std::ios::binary);
-	if (stream.fail())
+	if (!file->HasLength() || !file->Found())
 	{
-		std::string msg = "Failed to open bundle file containing the asset - " + file->bundle->path;
-		wrenSetSlotString(vm, 0, msg.c_str());
+		wrenSetSlotString(vm, 0, "Failed to read bundle file, bundle or length not set? Please report to SBLT");
 		wrenAbortFiber(vm, 0);
 		return;
 	}
@@ -291,11 +371,9 @@ static void wrenLoadAssetContents(WrenVM* vm)
 
 	try
 	{
-		stream.exceptions(std::ios::failbit | std::ios::eofbit);
-
-		std::vector<uint8_t> data = file->ReadContents(stream);
+		blt::db::AssetBuffer data = blt::db::AssetCache::Instance().Get(*file);
 
-		wrenSetSlotBytes(vm, 0, (const char*)data.data(), data.size());
+		wrenSetSlotBytes(vm, 0, (const char*)data->data(), data->size());
 	}
 	catch (const std::ios::failure& ex)
 	{
@@ -306,12 +384,178 @@ static void wrenLoadAssetContents(WrenVM* vm)
 		const char* err_buff = strerror(errno);
 #endif
 		std::string msg =
-			std::string("Failed to read asset - IO error: ") + std::string(err_buff) + " " + std::string(ex.what());
+			std::string("Failed to read asset from ") + file->bundle->path + " - IO error: " + std::string(err_buff) +
+			" " + std::string(ex.what());
 		wrenSetSlotString(vm, 0, msg.c_str());
 		wrenAbortFiber(vm, 0);
 	}
 }
 
+static void wrenLoadAssetContentsDirect(WrenVM* vm)
+{
+	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
+	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
+
+	std::optional<DslFile> file = DieselDB::Instance()->Find(name, ext);
+	if (!file)
+	{
+		wrenSetSlotNull(vm, 0);
+		return;
+	}
+
+	// This skips the asset cache, since the point is not to keep the asset around
+	try
+	{
+		std::vector<uint8_t> data = file->ReadRange(0, ~(uint64_t)0, true);
+		wrenSetSlotBytes(vm, 0, (const char*)data.data(), data.size());
+	}
+	catch (const std::exception& ex)
+	{
+		std::string msg = std::string("Failed to read asset - ") + ex.what();
+		wrenSetSlotString(vm, 0, msg.c_str());
+		wrenAbortFiber(vm, 0);
+	}
+}
+
+static void wrenPrefetch(WrenVM* vm)
+{
+	if (wrenGetSlotType(vm, 1) != WREN_TYPE_LIST)
+	{
+		wrenSetSlotString(vm, 0, "DBManager.prefetch: argument must be a list");
+		wrenAbortFiber(vm, 0);
+		return;
+	}
+
+	// Each entry is either a [name, ext] list for an asset, or the path to a file
+	wrenEnsureSlots(vm, 5);
+	std::vector<blt::db::PrefetchRange> ranges;
+	int count = wrenGetListCount(vm, 1);
+	for (int i = 0; i < count; i++)
+	{
+		wrenGetListElement(vm, 1, i, 2);
+
+		if (wrenGetSlotType(vm, 2) == WREN_TYPE_STRING)
+		{
+			ranges.push_back(blt::db::PrefetchRange::OfWholeFile(wrenGetSlotString(vm, 2)));
+			continue;
+		}
+
+		if (wrenGetSlotType(vm, 2) != WREN_TYPE_LIST || wrenGetListCount(vm, 2) != 2)
+		{
+			wrenSetSlotString(vm, 0, "DBManager.prefetch: entries must be a file path or a [name, ext] list");
+			wrenAbortFiber(vm, 0);
+			return;
+		}
+
+		wrenGetListElement(vm, 2, 0, 3);
+		wrenGetListElement(vm, 2, 1, 4);
+		blt::idstring name = parseHash(wrenGetSlotString(vm, 3));
+		blt::idstring ext = parseHash(wrenGetSlotString(vm, 4));
+
+		// Missing assets are ignored, since there's nothing to prefetch
+		std::optional<DslFile> file = DieselDB::Instance()->Find(name, ext);
+		if (file && file->Found())
+			ranges.push_back(blt::db::PrefetchRange::OfFile(*file));
+	}
+
+	wrenSetSlotDouble(vm, 0, (double)ranges.size());
+	blt::db::Prefetch(std::move(ranges));
+}
+
+// The maximum number of assets returned by each call to list_assets_chunk_
+static const int LIST_CHUNK_SIZE = 1024;
+
+static void setSlotHash(WrenVM* vm, int slot, blt::idstring value)
+{
+	char buff[32];
+	snprintf(buff, sizeof(buff), "@" IDPF, value);
+	wrenSetSlotString(vm, slot, buff);
+}
+
+// Arguments: name, type, bundle, language, cursor - all of which may be null
+// Returns [cursor, assets], where assets is a list of [name, ext, language] lists and cursor is passed in to get
+// the next chunk, or is null if there are no more assets. The cursor is a [DB generation, position] list, since the
+// position is meaningless if the DB has been reloaded in the meantime.
+static void wrenListAssetsChunk(WrenVM* vm)
+{
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+
+	blt::db::AssetQuery::Filter filter;
+	if (wrenGetSlotType(vm, 1) != WREN_TYPE_NULL)
+		filter.name = parseHash(wrenGetSlotString(vm, 1));
+	if (wrenGetSlotType(vm, 2) != WREN_TYPE_NULL)
+		filter.type = parseHash(wrenGetSlotString(vm, 2));
+	if (wrenGetSlotType(vm, 4) != WREN_TYPE_NULL)
+		filter.language = parseHash(wrenGetSlotString(vm, 4));
+
+	if (wrenGetSlotType(vm, 3) != WREN_TYPE_NULL)
+	{
+		std::string bundle = wrenGetSlotString(vm, 3);
+		filter.bundle = db->FindBundle(bundle);
+		if (!filter.bundle)
+		{
+			std::string msg = "DBManager.list_assets: no such bundle '" + bundle + "'";
+			wrenSetSlotString(vm, 0, msg.c_str());
+			wrenAbortFiber(vm, 0);
+			return;
+		}
+	}
+
+	// Slot 1 holds the list of assets, slot 2 the current asset and slot 3 the value being added to it
+	wrenEnsureSlots(vm, 6);
+
+	blt::db::AssetQuery query(db, filter);
+	if (wrenGetSlotType(vm, 5) != WREN_TYPE_NULL)
+	{
+		wrenGetListElement(vm, 5, 0, 2);
+		wrenGetListElement(vm, 5, 1, 3);
+		if ((uint64_t)wrenGetSlotDouble(vm, 2) != query.Generation())
+		{
+			wrenSetSlotString(vm, 0, "DBManager.list_assets: the asset DB was reloaded while listing assets");
+			wrenAbortFiber(vm, 0);
+			return;
+		}
+		query.Seek((uint32_t)wrenGetSlotDouble(vm, 3));
+	}
+
+	wrenSetSlotNewList(vm, 1);
+	for (int i = 0; i < LIST_CHUNK_SIZE; i++)
+	{
+		std::optional<DslFile> file = query.Next();
+		if (!file)
+			break;
+
+		wrenSetSlotNewList(vm, 2);
+		setSlotHash(vm, 3, file->name);
+		wrenInsertInList(vm, 2, -1, 3);
+		setSlotHash(vm, 3, file->type);
+		wrenInsertInList(vm, 2, -1, 3);
+		if (file->langId)
+			setSlotHash(vm, 3, file->langId);
+		else
+			wrenSetSlotNull(vm, 3);
+		wrenInsertInList(vm, 2, -1, 3);
+
+		wrenInsertInList(vm, 1, -1, 2);
+	}
+
+	wrenSetSlotNewList(vm, 0);
+	if (query.Done())
+	{
+		wrenSetSlotNull(vm, 2);
+	}
+	else
+	{
+		wrenSetSlotNewList(vm, 2);
+		wrenSetSlotDouble(vm, 3, (double)query.Generation());
+		wrenInsertInList(vm, 2, -1, 3);
+		wrenSetSlotDouble(vm, 3, (double)query.Cursor());
+		wrenInsertInList(vm, 2, -1, 3);
+	}
+	wrenInsertInList(vm, 0, -1, 2);
+	wrenInsertInList(vm, 0, -1, 1);
+}
+
 bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BLTAbstractDataStore** out_datastore,
                                                int64_t* out_pos, int64_t* out_len, std::string& out_name,
                                                bool fallback_mode)
@@ -338,9 +582,12 @@ bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BL
 
 	// TODO write to out_name somewhere
 
+	// Where the datastore's contents come from, for the IO stats
+	blt::db::IoSource source = blt::db::IoSource::PlainFile;
+
 	// Define these loading functions here, as we can use them either directly or after calling Wren
 	auto load_file = [&](const std::string& filename) {
-		BLTFileDataStore* ds = BLTFileDataStore::Open(filename);
+		BLTAbstractDataStore* ds = DieselDB::OpenFile(filename, target.read_mode);
 
 		if (!ds)
 		{
@@ -361,10 +608,11 @@ bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BL
 
 		*out_datastore = ds;
 		*out_len = ds->size();
+		source = blt::db::IoSource::PlainFile;
 	};
 
 	auto load_bundle_item = [&](blt::idfile bundle_item) {
-		DslFile* file = DieselDB::Instance()->Find(bundle_item.name, bundle_item.ext);
+		std::optional<DslFile> file = DieselDB::Instance()->Find(bundle_item.name, bundle_item.ext);
 
 		// Abort if the file isn't found - most likely this would lead to a crash anyway since the PD2 version
 		// of this asset probably isn't loaded (otherwise why would you hook it?), this just makes it obvious
@@ -386,7 +634,29 @@ bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BL
 #endif
 		}
 
-		BLTAbstractDataStore* ds = DieselDB::Instance()->Open(file->bundle);
+		// Small assets are served from the asset cache, so loading the same one repeatedly doesn't keep going back
+		// to the disk. The datastore shares the cached buffer rather than copying it. This doesn't apply if the hook
+		// asked for a particular read mode, since reading through the cache would ignore it.
+		source = blt::db::IoSource::Bundle;
+		blt::db::AssetCache& cache = blt::db::AssetCache::Instance();
+		if (target.read_mode == blt::db::ReadMode::Default && file->Found() && file->HasLength() &&
+		    cache.IsCacheable(file->length))
+		{
+			try
+			{
+				*out_datastore = new BLTSharedBufferDataStore(cache.Get(*file));
+				*out_len = (*out_datastore)->size();
+				return;
+			}
+			catch (const std::exception& ex)
+			{
+				// Let the engine read it directly instead, which will report the error if it's still broken
+				PD2HOOK_LOG_WARN(std::string("Failed to cache hooked asset from ") + file->bundle->path + ": " +
+				                 ex.what());
+			}
+		}
+
+		BLTAbstractDataStore* ds = DieselDB::Instance()->Open(file->bundle, target.read_mode);
 		*out_datastore = ds;
 		*out_pos = file->offset;
 
@@ -474,9 +744,10 @@ bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BL
 		}
 		else if (ff->stringLiteral)
 		{
-			auto* ds = new BLTStringDataStore(*ff->stringLiteral);
+			auto* ds = new BLTSharedBufferDataStore(ff->stringLiteral);
 			*out_datastore = ds;
 			*out_len = ds->size();
+			source = blt::db::IoSource::Wren;
 		}
 		else
 		{
@@ -496,6 +767,7 @@ bool pd2hook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, BL
 		return false;
 	}
 
+	*out_datastore = blt::db::IoStats::Instance().Wrap(*out_datastore, source);
 	return true;
 }
 
@@ -518,8 +790,8 @@ void DBForeignFile::ofAsset(WrenVM* vm)
 
 void DBForeignFile::fromString(WrenVM* vm)
 {
-	std::unique_ptr<std::string> contents = std::make_unique<std::string>(wrenGetSlotString(vm, 1));
-	create(vm)->stringLiteral = std::move(contents);
+	const char* str = wrenGetSlotString(vm, 1);
+	create(vm)->stringLiteral = std::make_shared<const std::vector<uint8_t>>(str, str + strlen(str));
 }
 
 DBForeignFile* DBForeignFile::create(WrenVM* vm)
@@ -652,6 +924,27 @@ void DBAssetHook::setWrenLoader(WrenVM* vm)
 	it->wren_loader_obj = wrenGetSlotHandle(vm, 1);
 }
 
+void DBAssetHook::getReadMode(WrenVM* vm)
+{
+	auto* it = get_this(vm);
+	wrenSetSlotString(vm, 0, blt::db::ReadModeName(it->read_mode));
+}
+
+void DBAssetHook::setReadMode(WrenVM* vm)
+{
+	auto* it = get_this(vm);
+
+	std::optional<blt::db::ReadMode> mode = blt::db::ParseReadMode(wrenGetSlotString(vm, 1));
+	if (!mode)
+	{
+		wrenSetSlotString(vm, 0, "DBAssetHook.read_mode: unknown read mode");
+		wrenAbortFiber(vm, 0);
+		return;
+	}
+
+	it->read_mode = *mode;
+}
+
 void DBAssetHook::finalise(void* this_data)
 {
 	auto* this_ptr = (DBAssetHook*)this_data;
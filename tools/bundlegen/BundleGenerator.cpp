@@ -0,0 +1,347 @@
+#include "BundleGenerator.h"
+
+#include <dbutil/DBFormat.h>
+#include <util/util.h>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <utility>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace blt::db::synthetic;
+using namespace blt::db::format;
+using blt::idstring;
+
+namespace
+{
+	// Marks an assets directory as containing a synthetic DB, so it's safe to clear out
+	const char* const MARKER_NAME = "synthetic_db";
+
+	/**
+	 * A small random number generator, so the output only depends on the seed and not on which standard library
+	 * it was built with.
+	 */
+	class SplitMix64
+	{
+	  public:
+		explicit SplitMix64(uint64_t seed) : state(seed)
+		{
+		}
+
+		uint64_t Next()
+		{
+			uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+
+		/** A number in the range [min, max] */
+		uint64_t Range(uint64_t min, uint64_t max)
+		{
+			return min + Next() % (max - min + 1);
+		}
+
+		/** A number in the range [0, 1) */
+		double Unit()
+		{
+			return (double)(Next() >> 11) / (double)(1ull << 53);
+		}
+
+		template <typename T> void Shuffle(std::vector<T>& values)
+		{
+			for (size_t i = values.size(); i > 1; i--)
+				std::swap(values[i - 1], values[Range(0, i - 1)]);
+		}
+
+	  private:
+		uint64_t state;
+	};
+
+	/** Builds up the contents of a file, as a list of records. */
+	class Buffer
+	{
+	  public:
+		template <typename T> void Append(const T& value)
+		{
+			const uint8_t* bytes = (const uint8_t*)&value;
+			data.insert(data.end(), bytes, bytes + sizeof(T));
+		}
+
+		[[nodiscard]] size_t Size() const
+		{
+			return data.size();
+		}
+
+		std::vector<uint8_t> data;
+	};
+
+	// One of the bundles the assets are split between
+	struct Container
+	{
+		std::string dataPath;
+		std::string headerPath; // Only used for packages
+		bool package;
+		std::vector<size_t> assets; // Indexes into the asset list, in the order they're stored in the bundle
+	};
+
+	void writeFile(const std::string& path, const void* data, size_t length)
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write((const char*)data, length);
+		if (!out.good())
+			PD2HOOK_SIMPLE_THROW_MSG("Failed to write synthetic DB file '" + path + "'");
+	}
+
+	// A header file is it's length followed by the contents, which all the pointers are relative to
+	void writeHeader(const std::string& path, const Buffer& body)
+	{
+		Buffer file;
+		file.Append((uint32_t)body.Size());
+		file.data.insert(file.data.end(), body.data.begin(), body.data.end());
+		writeFile(path, file.data.data(), file.Size());
+	}
+
+	dsl_Vector makeVector(size_t count, size_t offset)
+	{
+		dsl_Vector vec = {};
+		vec.size = (unsigned int)count;
+		vec.capacity = (unsigned int)count;
+		vec.contents_ptr = (intptr_t)offset;
+		vec.allocator = nullptr;
+		return vec;
+	}
+
+	void makeDirectory(const std::string& path)
+	{
+#ifdef _WIN32
+		int result = _mkdir(path.c_str());
+#else
+		int result = mkdir(path.c_str(), 0755);
+#endif
+		if (result != 0 && errno != EEXIST)
+			PD2HOOK_SIMPLE_THROW_MSG("Failed to create directory '" + path + "': " + strerror(errno));
+	}
+} // namespace
+
+std::vector<uint8_t> blt::db::synthetic::ExpectedContents(const GeneratedAsset& asset)
+{
+	SplitMix64 rng(asset.fileId * 0x2545f4914f6cdd1dull);
+	std::vector<uint8_t> data(asset.length);
+	for (size_t i = 0; i < data.size(); i += 8)
+	{
+		uint64_t value = rng.Next();
+		memcpy(data.data() + i, &value, std::min<size_t>(8, data.size() - i));
+	}
+	return data;
+}
+
+std::vector<GeneratedAsset> blt::db::synthetic::Generate(const GeneratorOptions& options)
+{
+	if (options.packageCount + options.allBundleCount == 0)
+		PD2HOOK_SIMPLE_THROW_MSG("A synthetic DB needs at least one bundle");
+	if (options.types.empty())
+		PD2HOOK_SIMPLE_THROW_MSG("A synthetic DB needs at least one asset type");
+	if (options.minSize > options.maxSize)
+		PD2HOOK_SIMPLE_THROW_MSG("The minimum asset size must not be larger than the maximum");
+
+	SplitMix64 rng(options.seed);
+
+	std::vector<idstring> types;
+	for (const std::string& type : options.types)
+		types.push_back(blt::idstring_hash(type));
+
+	// The raw language IDs are just their position in this list, starting at one since zero means no language
+	std::vector<idstring> languages;
+	for (const std::string& language : options.languages)
+		languages.push_back(blt::idstring_hash(language));
+
+	// Build the list of assets. Each name/type pair may come in several languages, which are separate assets.
+	std::vector<GeneratedAsset> assets;
+	std::set<std::pair<idstring, idstring>> used;
+	while (assets.size() < options.assetCount)
+	{
+		idstring name = rng.Next();
+		idstring type = types[rng.Range(0, types.size() - 1)];
+		if (!used.insert({name, type}).second)
+			continue;
+
+		double kind = rng.Unit();
+		bool localizedOnly = !languages.empty() && kind < options.localizedOnlyFraction;
+		bool localized =
+		    !languages.empty() && kind < options.localizedOnlyFraction + options.localizedFraction;
+
+		std::vector<idstring> versions;
+		if (!localizedOnly)
+			versions.push_back(0);
+		if (localized)
+			versions.insert(versions.end(), languages.begin(), languages.end());
+
+		for (idstring language : versions)
+		{
+			if (assets.size() >= options.assetCount)
+				break;
+
+			GeneratedAsset asset = {};
+			asset.name = name;
+			asset.type = type;
+			asset.language = language;
+			asset.fileId = (uint32_t)assets.size() + 1;
+			asset.length = (uint32_t)rng.Range(options.minSize, options.maxSize);
+			assets.push_back(asset);
+		}
+	}
+
+	// Clear out any bundles from a previous run, since the DB will pick up any package headers lying around. Only
+	// do this for directories we generated, so pointing this at a real game install doesn't delete it's assets.
+	std::string assetsDir = options.outputDir + "/assets";
+	std::string markerPath = assetsDir + "/" + MARKER_NAME;
+	makeDirectory(options.outputDir);
+	makeDirectory(assetsDir);
+
+	std::vector<std::string> existing = pd2hook::Util::GetDirectoryContents(assetsDir);
+	if (!existing.empty() && pd2hook::Util::GetFileType(markerPath) != pd2hook::Util::FileType_File)
+		PD2HOOK_SIMPLE_THROW_MSG("Refusing to overwrite '" + assetsDir + "', which wasn't made by the generator");
+
+	for (const std::string& name : existing)
+	{
+		if (name.size() > 7 && name.compare(name.size() - 7, 7, ".bundle") == 0)
+			remove((assetsDir + "/" + name).c_str());
+	}
+	writeFile(markerPath, "", 0);
+
+	// Set up the bundles, and split the assets between them
+	std::vector<Container> containers;
+	std::set<idstring> packageNames;
+	while (packageNames.size() < options.packageCount)
+	{
+		idstring packageName = rng.Next();
+		if (!packageNames.insert(packageName).second)
+			continue;
+
+		char name[32];
+		snprintf(name, sizeof(name), IDPF, packageName);
+		containers.push_back(Container{"assets/" + std::string(name) + ".bundle",
+		                               "assets/" + std::string(name) + "_h.bundle", true, {}});
+	}
+	for (size_t i = 0; i < options.allBundleCount; i++)
+	{
+		containers.push_back(Container{"assets/all_" + std::to_string(i) + ".bundle", "", false, {}});
+	}
+
+	for (size_t i = 0; i < assets.size(); i++)
+		containers[rng.Range(0, containers.size() - 1)].assets.push_back(i);
+
+	// Lay out and write each bundle. The assets are stored in a random order, so they're not sorted by file ID.
+	for (Container& container : containers)
+	{
+		rng.Shuffle(container.assets);
+
+		std::vector<uint8_t> data;
+		for (size_t i = 0; i < container.assets.size(); i++)
+		{
+			GeneratedAsset& asset = assets[container.assets[i]];
+			asset.bundlePath = container.dataPath;
+			asset.offset = (uint32_t)data.size();
+
+			// Package headers don't store lengths, so the last asset in them runs until the end of the bundle
+			bool last = i == container.assets.size() - 1;
+			asset.endOfFile = last && (container.package || options.endOfFileAssets);
+
+			std::vector<uint8_t> contents = ExpectedContents(asset);
+			data.insert(data.end(), contents.begin(), contents.end());
+		}
+
+		writeFile(options.outputDir + "/" + container.dataPath, data.data(), data.size());
+
+		if (!container.package)
+			continue;
+
+		Buffer body;
+		body.Append(makeVector(container.assets.size(), sizeof(dsl_Vector)));
+		for (size_t index : container.assets)
+			body.Append(FilePos{(int32_t)assets[index].fileId, (int32_t)assets[index].offset});
+		writeHeader(options.outputDir + "/" + container.headerPath, body);
+	}
+
+	// all_h.bundle lists the all_N bundles, followed by the items in each of them
+	{
+		Buffer body;
+		body.Append(makeVector(options.allBundleCount, sizeof(dsl_Vector)));
+		size_t itemsOffset = sizeof(dsl_Vector) + options.allBundleCount * sizeof(BundleInfo);
+		for (size_t i = 0; i < options.allBundleCount; i++)
+		{
+			const Container& container = containers[options.packageCount + i];
+
+			BundleInfo info = {};
+			info.id = (intptr_t)i;
+			info.zero = 0;
+			info.vec = makeVector(container.assets.size(), itemsOffset);
+			info.one = 1;
+			body.Append(info);
+
+			itemsOffset += container.assets.size() * sizeof(ItemInfo);
+		}
+
+		for (size_t i = 0; i < options.allBundleCount; i++)
+		{
+			for (size_t index : containers[options.packageCount + i].assets)
+			{
+				const GeneratedAsset& asset = assets[index];
+				body.Append(ItemInfo{asset.fileId, asset.offset, asset.endOfFile ? ~0u : asset.length});
+			}
+		}
+
+		writeHeader(assetsDir + "/all_h.bundle", body);
+	}
+
+	// bundle_db.blb lists the languages and all the assets. The assets are listed in a random order, like the
+	// game's are, so the DB can't rely on them being sorted by file ID.
+	{
+		std::vector<size_t> order(assets.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		rng.Shuffle(order);
+
+		size_t languagesOffset = sizeof(void*) + sizeof(dsl_Vector) + sizeof(void*) * 2 + sizeof(dsl_Vector);
+		size_t filesOffset = languagesOffset + languages.size() * sizeof(LanguageData);
+
+		Buffer blb;
+		blb.Append((intptr_t)0);
+		blb.Append(makeVector(languages.size(), languagesOffset));
+		blb.Append((intptr_t)0); // The sortmap, which the DB skips over
+		blb.Append((intptr_t)0);
+		blb.Append(makeVector(assets.size(), filesOffset));
+
+		for (size_t i = 0; i < languages.size(); i++)
+			blb.Append(LanguageData{languages[i], (int)i + 1, 0});
+
+		for (size_t index : order)
+		{
+			const GeneratedAsset& asset = assets[index];
+
+			int32_t langId = 0;
+			if (asset.language)
+			{
+				auto language = std::find(languages.begin(), languages.end(), asset.language);
+				langId = (int32_t)(language - languages.begin()) + 1;
+			}
+
+			blb.Append(MiniFile{asset.type, asset.name, langId, 0, (int32_t)asset.fileId, 0});
+		}
+
+		writeFile(assetsDir + "/bundle_db.blb", blb.data.data(), blb.Size());
+	}
+
+	return assets;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <platform.h>
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db::synthetic
+{
+
+	/**
+	 * The shape of a synthetic asset DB to generate. The defaults are a small DB, suitable for quick tests.
+	 */
+	struct GeneratorOptions
+	{
+		// The directory to write the DB into - the files go into it's assets directory, the same as a game install
+		std::string outputDir;
+
+		// The total number of assets, counting each language version separately
+		size_t assetCount = 10000;
+
+		// The number of package bundles (named after a hash, each with their own header) and all_N bundles (which
+		// all share all_h.bundle) to spread the assets between.
+		size_t packageCount = 20;
+		size_t allBundleCount = 4;
+
+		// The range of asset sizes, in bytes
+		uint32_t minSize = 16;
+		uint32_t maxSize = 4096;
+
+		// The asset types to use, picked at random for each asset
+		std::vector<std::string> types = {"texture", "unit", "model", "material_config", "sequence_manager"};
+
+		// The languages localized assets come in. Include english, so the DB's fallback to it can be tested.
+		std::vector<std::string> languages = {"english", "german", "french"};
+
+		// The fraction of assets that also come in each of the languages, and the fraction that only come in the
+		// languages, without a version that has no language.
+		double localizedFraction = 0.05;
+		double localizedOnlyFraction = 0.01;
+
+		// If set, the last asset in each all_N bundle doesn't have a length, meaning it runs until the end of the
+		// bundle. The last asset in each package bundle always works that way, since that's how package headers are.
+		bool endOfFileAssets = true;
+
+		uint64_t seed = 1;
+	};
+
+	/** An asset written into a synthetic DB, and where it ended up. */
+	struct GeneratedAsset
+	{
+		idstring name;
+		idstring type;
+		idstring language; // Zero if the asset doesn't have a language
+		uint32_t fileId;
+
+		std::string bundlePath; // Relative to the output directory, eg assets/all_2.bundle
+		uint32_t offset;
+		uint32_t length;
+		bool endOfFile; // If set, the DB doesn't know the length and has to use the size of the bundle
+	};
+
+	/**
+	 * Write a synthetic bundle_db.blb, the package and all_N bundles and their headers into the options' output
+	 * directory, in the same layouts the game uses (see DBFormat.h). These use the layout for the architecture
+	 * this was compiled for, the same as DB.cpp expects.
+	 *
+	 * Returns a list of the assets that were written. Throws if any of the files can't be written.
+	 */
+	std::vector<GeneratedAsset> Generate(const GeneratorOptions& options);
+
+	/**
+	 * Build the contents of an asset written by Generate, to check an asset read from the DB against. The contents
+	 * only depend on the asset's file ID and length, so this is the same regardless of where the asset is stored.
+	 */
+	std::vector<uint8_t> ExpectedContents(const GeneratedAsset& asset);
+
+}; // namespace blt::db::synthetic
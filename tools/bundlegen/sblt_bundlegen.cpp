@@ -0,0 +1,192 @@
+//
+// Generates a synthetic asset DB and set of bundles, for testing and benchmarking the DB code without a copy of
+// the game. The result can be loaded with sblt_dbtool -C <dir>, or checked against the DB with --verify.
+//
+
+#include "BundleGenerator.h"
+
+#include <dbutil/DB.h>
+#include <platform.h>
+#include <util/util.h>
+
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using blt::db::DieselDB;
+using blt::db::DslFile;
+using blt::db::synthetic::GeneratedAsset;
+using blt::db::synthetic::GeneratorOptions;
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "Usage: %s <dir> [options]\n"
+	        "\n"
+	        "Options:\n"
+	        "  --assets <n>           The total number of assets, counting each language separately (default: 10000)\n"
+	        "  --packages <n>         The number of package bundles (default: 20)\n"
+	        "  --all-bundles <n>      The number of all_N bundles (default: 4)\n"
+	        "  --min-size <bytes>     The size of the smallest asset (default: 16)\n"
+	        "  --max-size <bytes>     The size of the largest asset (default: 4096)\n"
+	        "  --languages <a,b,c>    The languages localized assets come in (default: english,german,french)\n"
+	        "  --localized <f>        The fraction of assets that also come in each language (default: 0.05)\n"
+	        "  --localized-only <f>   The fraction of assets that only come in each language (default: 0.01)\n"
+	        "  --no-eof               Give every asset in the all_N bundles a length\n"
+	        "  --seed <n>             The random seed (default: 1)\n"
+	        "  --verify               Load the generated DB, and check every asset can be found and read\n",
+	        name);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<std::string> splitList(const std::string& value)
+{
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= value.size())
+	{
+		size_t end = value.find(',', start);
+		if (end == std::string::npos)
+			end = value.size();
+		if (end > start)
+			parts.push_back(value.substr(start, end - start));
+		start = end + 1;
+	}
+	return parts;
+}
+
+// Check every generated asset against what the DB loaded from the generated files
+static int verify(const GeneratorOptions& options, const std::vector<GeneratedAsset>& assets)
+{
+	if (chdir(options.outputDir.c_str()) != 0)
+	{
+		fprintf(stderr, "Failed to change to directory '%s': %s\n", options.outputDir.c_str(), strerror(errno));
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	DieselDB::DeleteSnapshot();
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	printf("Loaded %zu files from %zu bundles in %.3fs\n", db->FileCount(), db->BundleCount(), secondsSince(start));
+
+	if (db->FileCount() != assets.size())
+	{
+		fprintf(stderr, "The DB has %zu files, expected %zu\n", db->FileCount(), assets.size());
+		return 1;
+	}
+
+	start = std::chrono::steady_clock::now();
+	size_t failures = 0;
+	for (const GeneratedAsset& asset : assets)
+	{
+		// Find just returns the first version of a file, so go through FindLocalized even for unlocalized assets
+		std::optional<DslFile> file = db->FindLocalized(asset.name, asset.type, asset.language, false);
+
+		std::string problem;
+		if (!file)
+			problem = "not found";
+		else if (file->fileId != (int)asset.fileId)
+			problem = "has file ID " + std::to_string(file->fileId);
+		else if (!file->Found() || file->bundle->path != asset.bundlePath)
+			problem = "is in the wrong bundle";
+		else if (file->HasLength() == asset.endOfFile)
+			problem = asset.endOfFile ? "should run to the end of the bundle" : "should have a length";
+		else if (file->ReadRange(0, asset.length + 1) != blt::db::synthetic::ExpectedContents(asset))
+			problem = "has the wrong contents";
+
+		if (problem.empty())
+			continue;
+
+		if (failures++ < 20)
+		{
+			fprintf(stderr, "Asset " IDPFP " (language " IDPF ", file ID %u) %s\n", asset.name, asset.type,
+			        asset.language, asset.fileId, problem.c_str());
+		}
+	}
+
+	if (failures)
+	{
+		fprintf(stderr, "%zu of %zu assets failed to verify\n", failures, assets.size());
+		return 1;
+	}
+
+	printf("Verified %zu assets in %.3fs\n", assets.size(), secondsSince(start));
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	GeneratorOptions options;
+	options.outputDir = argv[1];
+	bool shouldVerify = false;
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string opt = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (opt == "--assets" && hasValue)
+			options.assetCount = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--packages" && hasValue)
+			options.packageCount = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--all-bundles" && hasValue)
+			options.allBundleCount = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--min-size" && hasValue)
+			options.minSize = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (opt == "--max-size" && hasValue)
+			options.maxSize = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (opt == "--languages" && hasValue)
+			options.languages = splitList(argv[++i]);
+		else if (opt == "--localized" && hasValue)
+			options.localizedFraction = atof(argv[++i]);
+		else if (opt == "--localized-only" && hasValue)
+			options.localizedOnlyFraction = atof(argv[++i]);
+		else if (opt == "--no-eof")
+			options.endOfFileAssets = false;
+		else if (opt == "--seed" && hasValue)
+			options.seed = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--verify")
+			shouldVerify = true;
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	try
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<GeneratedAsset> assets = blt::db::synthetic::Generate(options);
+		printf("Generated %zu assets in %zu bundles in %.3fs\n", assets.size(),
+		       options.packageCount + options.allBundleCount, secondsSince(start));
+
+		if (shouldVerify)
+			return verify(options, assets);
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "Error: %s\n", ex.what());
+		return 1;
+	}
+
+	return 0;
+}
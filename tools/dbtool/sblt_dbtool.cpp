@@ -0,0 +1,580 @@
+//
+// A standalone tool for working with the game's asset DB outside of the game.
+//
+// This loads the DB with exactly the same code SuperBLT uses in-game, so it can be used to profile changes to the
+// DB code, and to extract assets without having to launch the game.
+//
+
+#include <dbutil/AssetQuery.h>
+#include <dbutil/BatchRead.h>
+#include <dbutil/CompressedFile.h>
+#include <dbutil/DB.h>
+#include <platform.h>
+#include <util/util.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using blt::idstring;
+using blt::db::AssetQuery;
+using blt::db::DieselDB;
+using blt::db::DslFile;
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] <command> [arguments]\n"
+	        "\n"
+	        "Options:\n"
+	        "  -C <dir>       Use the game installed in this directory, rather than the current directory\n"
+	        "  --cold         Ignore the DB cache, and parse all the bundle headers\n"
+	        "  -j <threads>   The number of threads to extract assets with (default: one per core)\n"
+	        "\n"
+	        "Commands:\n"
+	        "  info                       Load the DB, and show how long each step took\n"
+	        "  bench [lookups] [reads]    Benchmark looking up and reading assets\n"
+	        "  bench-index [assets] [lookups]\n"
+	        "                             Compare the DB's file index against a std::map, using made-up assets.\n"
+	        "                             This doesn't need the game to be installed.\n"
+	        "  extract <dir> [filters]    Extract assets into a directory, with any of these filters:\n"
+	        "      --type <ext>           Only extract assets of this type\n"
+	        "      --bundle <name>        Only extract assets in this bundle (eg all_5)\n"
+	        "      --language <lang>      Only extract assets in this language\n"
+	        "      --list <file>          Extract the assets listed in this file, one path.ext per line\n"
+	        "  compress <in> <out> [KiB]  Compress a mod's asset file, so SuperBLT decompresses it as it's read.\n"
+	        "                             The chunk size (default: 256) is how much is decompressed at once.\n"
+	        "                             Files added with DB:create_entry can only be compressed on Linux.\n"
+	        "\n"
+	        "Asset names may be given as a hash by writing them as @ followed by 16 hex digits.\n",
+	        name);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Parse a name the same way Wren's DBManager does
+static idstring parseHash(const std::string& value)
+{
+	if (value.size() == 17 && value[0] == '@')
+	{
+		char* end = nullptr;
+		idstring id = strtoull(value.c_str() + 1, &end, 16);
+		if (end != value.c_str() + 17)
+			PD2HOOK_SIMPLE_THROW_MSG("Invalid hash '" + value + "'");
+		return id;
+	}
+
+	return blt::idstring_hash(value);
+}
+
+/////////////////////
+////// INFO /////////
+/////////////////////
+
+static int cmdInfo(const std::vector<std::string>&)
+{
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	const DieselDB::LoadTimes& times = db->GetLoadTimes();
+
+	auto step = [](const char* name, uint64_t micros) { printf("  %-24s %10.3f ms\n", name, micros / 1000.0); };
+
+	printf("Loaded %zd files in %zd bundles from %s\n", db->FileCount(), db->BundleCount(),
+	       times.fromSnapshot ? "the DB cache" : "the bundle headers");
+	step("list headers", times.listHeaders);
+	step("fingerprint", times.fingerprint);
+	step("load cache", times.loadSnapshot);
+	if (!times.fromSnapshot)
+	{
+		step("parse bundle_db.blb", times.parseDatabase);
+		step("parse bundle headers", times.parseHeaders);
+		step("apply bundle headers", times.applyHeaders);
+		step("build localized index", times.buildLocalizedIndex);
+		step("save cache", times.saveSnapshot);
+	}
+	step("total", times.total);
+
+	printf("Heap memory used: %zd KiB\n", db->HeapSize() / 1024);
+
+	// Count the files of each type, which gives a rough idea of what's in there
+	std::map<idstring, size_t> types;
+	const blt::db::DslFileTable& table = db->Files();
+	for (uint32_t i = 0; i < table.Size(); i++)
+		types[table.types[i]]++;
+	printf("%zd types, %zd languages\n", types.size(), table.languageTable.size());
+
+	return 0;
+}
+
+/////////////////////
+////// BENCH ////////
+/////////////////////
+
+static int cmdBench(const std::vector<std::string>& args)
+{
+	size_t lookupCount = args.size() > 0 ? std::stoul(args[0]) : 10000000;
+	size_t readCount = args.size() > 1 ? std::stoul(args[1]) : 10000;
+
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	const blt::db::DslFileTable& table = db->Files();
+	if (table.Size() == 0)
+		PD2HOOK_SIMPLE_THROW_MSG("The DB is empty");
+
+	// Look files up in a random order, so we're not just walking through the index in memory order
+	std::mt19937_64 rng(1234);
+	std::vector<uint32_t> order(table.Size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = (uint32_t)i;
+	std::shuffle(order.begin(), order.end(), rng);
+
+	// Sum something from the results, so the lookups can't be optimised out
+	uint64_t checksum = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < lookupCount; i++)
+	{
+		uint32_t index = order[i % order.size()];
+		std::optional<DslFile> file = db->Find(table.names[index], table.types[index]);
+		checksum += file ? file->offset : 0;
+	}
+	double elapsed = secondsSince(start);
+	printf("Find (hits):        %10.2f M lookups/s\n", lookupCount / elapsed / 1e6);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < lookupCount; i++)
+	{
+		std::optional<DslFile> file = db->Find(rng(), rng());
+		checksum += file ? file->offset : 0;
+	}
+	elapsed = secondsSince(start);
+	printf("Find (misses):      %10.2f M lookups/s\n", lookupCount / elapsed / 1e6);
+
+	static const idstring english = blt::idstring_hash("english");
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < lookupCount; i++)
+	{
+		uint32_t index = order[i % order.size()];
+		std::optional<DslFile> file = db->FindLocalized(table.names[index], table.types[index], english);
+		checksum += file ? file->offset : 0;
+	}
+	elapsed = secondsSince(start);
+	printf("FindLocalized:      %10.2f M lookups/s\n", lookupCount / elapsed / 1e6);
+
+	// Use a different set of assets for each read benchmark, so the second doesn't only hit the page cache
+	std::vector<DslFile> singleFiles, batchFiles;
+	for (size_t i = 0; i < readCount * 2 && i < order.size(); i++)
+	{
+		DslFile file = db->GetFile(order[order.size() - 1 - i]);
+		if (file.Found())
+			(i % 2 ? batchFiles : singleFiles).push_back(file);
+	}
+
+	uint64_t bytes = 0;
+	start = std::chrono::steady_clock::now();
+	for (const DslFile& file : singleFiles)
+		bytes += file.ReadRange(0, ~(uint64_t)0).size();
+	elapsed = secondsSince(start);
+	printf("Single reads:       %10.0f files/s, %8.2f MiB/s (%zd files)\n", singleFiles.size() / elapsed,
+	       bytes / elapsed / 1024 / 1024, singleFiles.size());
+
+	bytes = 0;
+	start = std::chrono::steady_clock::now();
+	blt::db::ReadFiles(batchFiles, [&bytes](size_t, const uint8_t*, size_t length) { bytes += length; });
+	elapsed = secondsSince(start);
+	printf("Batched reads:      %10.0f files/s, %8.2f MiB/s (%zd files)\n", batchFiles.size() / elapsed,
+	       bytes / elapsed / 1024 / 1024, batchFiles.size());
+
+	printf("(checksum %llx)\n", (unsigned long long)checksum);
+	return 0;
+}
+
+/////////////////////
+//// BENCH-INDEX ////
+/////////////////////
+
+// Compare FileIndex against the std::map DieselDB used to look files up with, using synthetic names so the
+// results don't depend on what's installed. 80% of the lookups are for assets that exist.
+static int cmdBenchIndex(const std::vector<std::string>& args)
+{
+	size_t assetCount = args.size() > 0 ? std::stoul(args[0]) : 400000;
+	size_t lookupCount = args.size() > 1 ? std::stoul(args[1]) : 10000000;
+	if (assetCount == 0)
+		PD2HOOK_SIMPLE_THROW_MSG("The asset count must not be zero");
+
+	// Real DBs only have a few dozen types, so draw them from a small set
+	std::mt19937_64 rng(1234);
+	std::vector<idstring> types(40);
+	for (idstring& type : types)
+		type = rng();
+
+	std::vector<std::pair<idstring, idstring>> assets(assetCount);
+	for (auto& asset : assets)
+		asset = {rng(), types[rng() % types.size()]};
+
+	std::vector<std::pair<idstring, idstring>> queries(std::min<size_t>(lookupCount, 1 << 20));
+	for (auto& query : queries)
+	{
+		if (rng() % 5 == 0)
+			query = {rng(), types[rng() % types.size()]};
+		else
+			query = assets[rng() % assets.size()];
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::map<std::pair<idstring, idstring>, uint32_t> map;
+	for (uint32_t i = 0; i < assets.size(); i++)
+		map[assets[i]] = i;
+	double mapBuild = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	blt::db::FileIndex index;
+	index.Reset(assets.size());
+	for (uint32_t i = 0; i < assets.size(); i++)
+	{
+		blt::db::FileIndex::Slot& slot = index.Locate(assets[i].first, assets[i].second);
+		slot.name = assets[i].first;
+		slot.type = assets[i].second;
+		slot.file = i;
+	}
+	double indexBuild = secondsSince(start);
+
+	// Sum the results, so the lookups can't be optimised out
+	uint64_t mapChecksum = 0, indexChecksum = 0;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < lookupCount; i++)
+	{
+		auto iter = map.find(queries[i % queries.size()]);
+		mapChecksum += iter == map.end() ? blt::db::FileIndex::EMPTY : iter->second;
+	}
+	double mapLookup = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < lookupCount; i++)
+	{
+		const auto& query = queries[i % queries.size()];
+		indexChecksum += index.Find(query.first, query.second);
+	}
+	double indexLookup = secondsSince(start);
+
+	if (mapChecksum != indexChecksum)
+		PD2HOOK_SIMPLE_THROW_MSG("The index and map disagree about which assets exist");
+
+	printf("%zd assets, %zd lookups\n", assets.size(), lookupCount);
+	printf("  %-10s %10.3f ms build %10.2f ns/lookup\n", "std::map", mapBuild * 1000, mapLookup / lookupCount * 1e9);
+	printf("  %-10s %10.3f ms build %10.2f ns/lookup\n", "FileIndex", indexBuild * 1000,
+	       indexLookup / lookupCount * 1e9);
+	return 0;
+}
+
+/////////////////////
+////// EXTRACT //////
+/////////////////////
+
+// The directory the tool was started in, since -C changes it
+static std::string startDir;
+
+// Create all the directories leading up to the given file
+static void makeParentDirs(const std::string& path)
+{
+	for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+	{
+		std::string dir = path.substr(0, pos);
+		if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+			PD2HOOK_SIMPLE_THROW_MSG("Failed to create directory '" + dir + "': " + strerror(errno));
+	}
+}
+
+struct ExtractJob
+{
+	DslFile file;
+	std::string path; // Relative to the output directory
+};
+
+static std::string hashPath(const DslFile& file)
+{
+	char buff[64];
+	if (file.langId)
+		snprintf(buff, sizeof(buff), IDPF "." IDPF "." IDPF, file.name, file.langId, file.type);
+	else
+		snprintf(buff, sizeof(buff), IDPFP, file.name, file.type);
+	return buff;
+}
+
+// Read a list of assets to extract, one "path/to/asset.ext" per line
+static void readList(const std::string& filename, std::optional<idstring> language, std::vector<ExtractJob>& jobs)
+{
+	std::ifstream in(filename);
+	if (!in.good())
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open list file '" + filename + "'");
+
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	std::string line;
+	while (std::getline(in, line))
+	{
+		line.erase(line.find_last_not_of(" \t\r\n") + 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		size_t dot = line.find_last_of('.');
+		if (dot == std::string::npos)
+			PD2HOOK_SIMPLE_THROW_MSG("List entry '" + line + "' is missing it's extension");
+
+		idstring name = parseHash(line.substr(0, dot));
+		idstring ext = parseHash(line.substr(dot + 1));
+		std::optional<DslFile> file = language ? db->FindLocalized(name, ext, *language) : db->Find(name, ext);
+		if (!file || !file->Found())
+		{
+			fprintf(stderr, "Skipping '%s': not found in the DB\n", line.c_str());
+			continue;
+		}
+
+		jobs.push_back(ExtractJob{*file, line});
+	}
+}
+
+static int cmdExtract(const std::vector<std::string>& args, unsigned int threadCount)
+{
+	if (args.empty())
+		PD2HOOK_SIMPLE_THROW_MSG("extract: missing output directory");
+	std::string outDir = args[0];
+	if (outDir[0] != '/')
+		outDir = startDir + "/" + outDir;
+
+	std::shared_ptr<DieselDB> db = DieselDB::Instance();
+	AssetQuery::Filter filter;
+	std::optional<std::string> listFile;
+	for (size_t i = 1; i < args.size(); i++)
+	{
+		if (i + 1 >= args.size())
+			PD2HOOK_SIMPLE_THROW_MSG("extract: missing value for " + args[i]);
+		const std::string& value = args[++i];
+
+		if (args[i - 1] == "--type")
+			filter.type = parseHash(value);
+		else if (args[i - 1] == "--language")
+			filter.language = parseHash(value);
+		else if (args[i - 1] == "--list")
+			listFile = value;
+		else if (args[i - 1] == "--bundle")
+		{
+			filter.bundle = db->FindBundle(value);
+			if (!filter.bundle)
+				PD2HOOK_SIMPLE_THROW_MSG("extract: no such bundle '" + value + "'");
+		}
+		else
+			PD2HOOK_SIMPLE_THROW_MSG("extract: unknown option " + args[i - 1]);
+	}
+
+	std::vector<ExtractJob> jobs;
+	if (listFile)
+	{
+		readList(*listFile, filter.language, jobs);
+	}
+	else
+	{
+		AssetQuery query(db, filter);
+		while (std::optional<DslFile> file = query.Next())
+		{
+			if (file->Found())
+				jobs.push_back(ExtractJob{*file, hashPath(*file)});
+		}
+	}
+
+	// Split the assets up by bundle, so each thread reads whole bundles from front to back
+	std::map<blt::db::DieselBundle*, std::vector<const ExtractJob*>> byBundle;
+	for (const ExtractJob& job : jobs)
+		byBundle[job.file.bundle].push_back(&job);
+	std::vector<std::vector<const ExtractJob*>> groups;
+	for (auto& pair : byBundle)
+		groups.push_back(std::move(pair.second));
+
+	// Do the biggest bundles first, so one of them doesn't get left running on it's own at the end
+	std::sort(groups.begin(), groups.end(), [](const auto& a, const auto& b) { return a.size() > b.size(); });
+
+	printf("Extracting %zd assets from %zd bundles using %u threads\n", jobs.size(), groups.size(), threadCount);
+
+	std::atomic<size_t> nextGroup{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<size_t> failures{0};
+
+	auto worker = [&]() {
+		for (size_t g = nextGroup++; g < groups.size(); g = nextGroup++)
+		{
+			const std::vector<const ExtractJob*>& group = groups[g];
+			std::vector<DslFile> files;
+			for (const ExtractJob* job : group)
+				files.push_back(job->file);
+
+			try
+			{
+				blt::db::ReadFiles(files, [&](size_t index, const uint8_t* data, size_t length) {
+					std::string path = outDir + "/" + group[index]->path;
+					makeParentDirs(path);
+
+					std::ofstream out(path, std::ios::binary | std::ios::trunc);
+					out.write((const char*)data, length);
+					if (!out.good())
+					{
+						fprintf(stderr, "Failed to write '%s'\n", path.c_str());
+						failures++;
+						return;
+					}
+					bytes += length;
+				});
+			}
+			catch (const std::exception& ex)
+			{
+				fprintf(stderr, "Failed to read from %s: %s\n", group.front()->file.bundle->path.c_str(), ex.what());
+				failures += group.size();
+			}
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < threadCount; i++)
+		threads.emplace_back(worker);
+	for (std::thread& thread : threads)
+		thread.join();
+	double elapsed = secondsSince(start);
+
+	printf("Extracted %zd assets (%.2f MiB) in %.3f s, %.2f MiB/s\n", jobs.size() - failures,
+	       bytes / 1024.0 / 1024.0, elapsed, bytes / elapsed / 1024 / 1024);
+	return failures ? 1 : 0;
+}
+
+/////////////////////
+////// COMPRESS /////
+/////////////////////
+
+static int cmdCompress(const std::vector<std::string>& args)
+{
+	if (args.size() < 2)
+		PD2HOOK_SIMPLE_THROW_MSG("compress: missing input or output file");
+
+	std::string inPath = args[0][0] == '/' ? args[0] : startDir + "/" + args[0];
+	std::string outPath = args[1][0] == '/' ? args[1] : startDir + "/" + args[1];
+	uint32_t chunkSize = blt::db::compressed::DEFAULT_CHUNK_SIZE;
+	if (args.size() > 2)
+		chunkSize = (uint32_t)std::stoul(args[2]) * 1024;
+
+	std::unique_ptr<BLTAbstractDataStore> in(DieselDB::OpenFile(inPath));
+	if (!in)
+		PD2HOOK_SIMPLE_THROW_MSG("compress: failed to open '" + inPath + "'");
+
+	std::vector<uint8_t> contents(in->size());
+	if (in->read(0, contents.data(), contents.size()) != contents.size())
+		PD2HOOK_SIMPLE_THROW_MSG("compress: failed to read '" + inPath + "'");
+	in.reset();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<uint8_t> compressed = blt::db::compressed::Compress(contents.data(), contents.size(), chunkSize);
+	double elapsed = secondsSince(start);
+
+	std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+	out.write((const char*)compressed.data(), compressed.size());
+	out.close();
+	if (!out.good())
+		PD2HOOK_SIMPLE_THROW_MSG("compress: failed to write '" + outPath + "'");
+
+	// Read it back, to make sure it decompresses to exactly what went in
+	std::unique_ptr<BLTAbstractDataStore> check(DieselDB::OpenFile(outPath));
+	std::vector<uint8_t> roundTrip(contents.size());
+	if (!check || check->size() != contents.size() ||
+	    check->read(0, roundTrip.data(), roundTrip.size()) != roundTrip.size() || roundTrip != contents)
+		PD2HOOK_SIMPLE_THROW_MSG("compress: '" + outPath + "' doesn't decompress to the original file");
+
+	printf("Compressed %zd bytes to %zd (%.1f%%) in %.3f s\n", contents.size(), compressed.size(),
+	       contents.empty() ? 100.0 : compressed.size() * 100.0 / contents.size(), elapsed);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+	bool cold = false;
+
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)))
+		startDir = cwd;
+
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++)
+	{
+		std::string opt = argv[i];
+		if (opt == "-C" && i + 1 < argc)
+		{
+			if (chdir(argv[++i]) != 0)
+			{
+				fprintf(stderr, "Failed to change to directory '%s': %s\n", argv[i], strerror(errno));
+				return 1;
+			}
+		}
+		else if (opt == "-j" && i + 1 < argc)
+		{
+			threadCount = std::max(1, atoi(argv[++i]));
+		}
+		else if (opt == "--cold")
+		{
+			cold = true;
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (i >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::string command = argv[i];
+	std::vector<std::string> args(argv + i + 1, argv + argc);
+
+	if (cold)
+		DieselDB::DeleteSnapshot();
+
+	try
+	{
+		if (command == "info")
+			return cmdInfo(args);
+		else if (command == "bench")
+			return cmdBench(args);
+		else if (command == "bench-index")
+			return cmdBenchIndex(args);
+		else if (command == "extract")
+			return cmdExtract(args, threadCount);
+		else if (command == "compress")
+			return cmdCompress(args);
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "Error: %s\n", ex.what());
+		return 1;
+	}
+
+	usage(argv[0]);
+	return 1;
+}
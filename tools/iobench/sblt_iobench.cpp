@@ -0,0 +1,455 @@
+//
+// Benchmarks the datastores SuperBLT hands to the engine against each other, using the same read patterns the
+// engine does: lots of small reads from all over a bundle, a few large reads working through it, and opening a
+// new datastore for each asset as asset hooks do.
+//
+// The file is read through the page cache, so run it once to warm the cache up before comparing the results.
+//
+// It also replays a pattern of reads, either from a file or made up to look like the engine reading assets, and
+// counts the system calls each datastore makes for it.
+//
+
+#include <dbutil/BundleHandlePool.h>
+#include <dbutil/Datastore.h>
+#include <dbutil/MappedFile.h>
+#include <platform.h>
+#include <util/util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using blt::db::BundleHandlePool;
+using blt::db::MappedFile;
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "Usage: %s <file> [options]\n"
+	        "\n"
+	        "Options:\n"
+	        "  --create <MiB>         Write a file of this size to benchmark against first\n"
+	        "  --small-reads <n>      The number of small reads (default: 200000)\n"
+	        "  --small-size <bytes>   The size of each small read (default: 4096)\n"
+	        "  --large-size <bytes>   The size of each large read, which go through the whole file (default: 8MiB)\n"
+	        "  --opens <n>            The number of datastores to open, reading from each once (default: 20000)\n"
+	        "  --pattern <file>       Replay the reads in this file, one 'offset length' pair per line, rather\n"
+	        "                         than a made-up pattern of reads\n",
+	        name);
+}
+
+struct Options
+{
+	std::string path;
+	size_t smallReads = 200000;
+	size_t smallSize = 4096;
+	size_t largeSize = 8 * 1024 * 1024;
+	size_t opens = 20000;
+	std::string patternPath;
+};
+
+struct PatternRead
+{
+	uint64_t offset;
+	size_t length;
+};
+
+// One way of opening a datastore to benchmark
+struct Candidate
+{
+	const char* name;
+	std::function<BLTAbstractDataStore*(const std::string&)> open;
+};
+
+// The datastore asset hooks used to use, with a file descriptor of it's own
+static BLTAbstractDataStore* openFile(const std::string& path)
+{
+	return BLTFileDataStore::Open(path);
+}
+
+// The datastore DieselDB::Open uses by default, sharing a file descriptor
+static BLTAbstractDataStore* openShared(const std::string& path)
+{
+	return new BLTSharedFileDataStore(BundleHandlePool::Instance().Get(path));
+}
+
+// A mapping of it's own, as DieselDB::OpenFile uses for mapped plain files
+static BLTAbstractDataStore* openMapped(const std::string& path)
+{
+	return BLTMappedDataStore::Open(path, MappedFile::Access::Normal);
+}
+
+// A shared mapping, as DieselDB::Open uses for mapped bundles
+static BLTAbstractDataStore* openMappedPool(const std::string& path)
+{
+	return new BLTMappedDataStore(BundleHandlePool::Instance().GetMapping(path));
+}
+
+// Counts the reads made from another datastore, which for a file datastore are the system calls it makes
+class CountingDataStore : public BLTAbstractDataStore
+{
+  public:
+	CountingDataStore(BLTAbstractDataStore* inner, size_t& counter) : inner(inner), counter(counter)
+	{
+	}
+
+	size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override
+	{
+		counter++;
+		return inner->read(position_in_file, data, length);
+	}
+
+	bool close() override
+	{
+		return inner->close();
+	}
+
+	size_t size() const override
+	{
+		return inner->size();
+	}
+
+	bool is_asynchronous() const override
+	{
+		return false;
+	}
+
+	bool good() const override
+	{
+		return inner->good();
+	}
+
+  private:
+	std::unique_ptr<BLTAbstractDataStore> inner;
+	size_t& counter;
+};
+
+// One way of opening a datastore to replay a pattern with, and the number of system calls each read it passes
+// to the file makes
+struct PatternCandidate
+{
+	const char* name;
+	size_t syscallsPerRead;
+	std::function<BLTAbstractDataStore*(const std::string&, size_t& counter)> open;
+};
+
+static BLTAbstractDataStore* openCountedFile(const std::string& path, size_t& counter)
+{
+	// This seeks, then reads
+	return new CountingDataStore(BLTFileDataStore::Open(path), counter);
+}
+
+static BLTAbstractDataStore* openCountedShared(const std::string& path, size_t& counter)
+{
+	return new CountingDataStore(openShared(path), counter);
+}
+
+static BLTAbstractDataStore* openCountedBuffered(const std::string& path, size_t& counter)
+{
+	return new BLTBufferedDataStore(new CountingDataStore(openShared(path), counter));
+}
+
+static BLTAbstractDataStore* openCountedMapped(const std::string& path, size_t& counter)
+{
+	return new CountingDataStore(openMappedPool(path), counter);
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void createFile(const std::string& path, size_t mebibytes)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	std::mt19937_64 rng(1);
+	std::vector<uint64_t> block(1024 * 1024 / sizeof(uint64_t));
+	for (size_t i = 0; i < mebibytes; i++)
+	{
+		for (uint64_t& value : block)
+			value = rng();
+		out.write((const char*)block.data(), block.size() * sizeof(uint64_t));
+	}
+
+	if (!out.good())
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to write benchmark file '" + path + "'");
+}
+
+// Sum up the data that was read, so the reads can't be optimised away
+static uint64_t checksum(const std::vector<uint8_t>& buffer, size_t length)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < length; i += 64)
+		sum += buffer[i];
+	return sum;
+}
+
+static void printResult(const char* name, size_t reads, uint64_t bytes, double seconds)
+{
+	printf("  %-12s %9.3f ms  %8.0f ns/read  %8.1f MiB/s\n", name, seconds * 1000, seconds * 1e9 / reads,
+	       bytes / seconds / (1024 * 1024));
+}
+
+static void benchSmall(const Options& options, const std::vector<Candidate>& candidates)
+{
+	printf("%zu random reads of %zu bytes:\n", options.smallReads, options.smallSize);
+
+	for (const Candidate& candidate : candidates)
+	{
+		std::unique_ptr<BLTAbstractDataStore> ds(candidate.open(options.path));
+		size_t limit = ds->size() - options.smallSize;
+
+		std::mt19937_64 rng(2);
+		std::vector<uint8_t> buffer(options.smallSize);
+		uint64_t sum = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < options.smallReads; i++)
+		{
+			ds->read(rng() % limit, buffer.data(), buffer.size());
+			sum += checksum(buffer, buffer.size());
+		}
+		double seconds = secondsSince(start);
+
+		printResult(candidate.name, options.smallReads, (uint64_t)options.smallReads * options.smallSize, seconds);
+		if (sum == 0)
+			printf("  (checksum was zero)\n");
+	}
+}
+
+static void benchLarge(const Options& options, const std::vector<Candidate>& candidates)
+{
+	printf("Reading the whole file in %zu byte pieces:\n", options.largeSize);
+
+	for (const Candidate& candidate : candidates)
+	{
+		std::unique_ptr<BLTAbstractDataStore> ds(candidate.open(options.path));
+
+		std::vector<uint8_t> buffer(options.largeSize);
+		uint64_t sum = 0;
+		size_t reads = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t pos = 0; pos < ds->size(); pos += buffer.size())
+		{
+			size_t length = std::min(buffer.size(), ds->size() - pos);
+			ds->read(pos, buffer.data(), length);
+			sum += checksum(buffer, length);
+			reads++;
+		}
+		double seconds = secondsSince(start);
+
+		printResult(candidate.name, reads, ds->size(), seconds);
+		if (sum == 0)
+			printf("  (checksum was zero)\n");
+	}
+}
+
+static void benchOpens(const Options& options, const std::vector<Candidate>& candidates)
+{
+	printf("%zu datastores opened, each reading %zu bytes:\n", options.opens, options.smallSize);
+
+	for (const Candidate& candidate : candidates)
+	{
+		std::mt19937_64 rng(3);
+		std::vector<uint8_t> buffer(options.smallSize);
+		uint64_t sum = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < options.opens; i++)
+		{
+			std::unique_ptr<BLTAbstractDataStore> ds(candidate.open(options.path));
+			ds->read(rng() % (ds->size() - options.smallSize), buffer.data(), buffer.size());
+			sum += checksum(buffer, buffer.size());
+		}
+		double seconds = secondsSince(start);
+
+		printResult(candidate.name, options.opens, (uint64_t)options.opens * options.smallSize, seconds);
+		if (sum == 0)
+			printf("  (checksum was zero)\n");
+	}
+}
+
+// Read a recorded pattern of reads, one "offset length" pair per line
+static std::vector<PatternRead> loadPattern(const std::string& path, size_t fileSize)
+{
+	std::ifstream in(path);
+	if (!in.good())
+		PD2HOOK_SIMPLE_THROW_MSG("Failed to open pattern file '" + path + "'");
+
+	std::vector<PatternRead> pattern;
+	std::string line;
+	while (std::getline(in, line))
+	{
+		PatternRead read = {0, 0};
+		std::istringstream fields(line);
+		if (!(fields >> read.offset >> read.length))
+			continue;
+
+		if (read.offset + read.length > fileSize)
+			PD2HOOK_SIMPLE_THROW_MSG("Pattern read at " + std::to_string(read.offset) + " goes past the end of the file");
+		pattern.push_back(read);
+	}
+	return pattern;
+}
+
+// Make up a pattern that looks like the engine loading assets: for each asset, a few small reads of it's header
+// fields, then it's chunks in order, some of which are big enough not to be worth buffering.
+static std::vector<PatternRead> makePattern(size_t fileSize)
+{
+	std::mt19937_64 rng(4);
+	std::vector<PatternRead> pattern;
+
+	for (int asset = 0; asset < 2000; asset++)
+	{
+		size_t assetSize = 4096 + rng() % (512 * 1024);
+		if (assetSize >= fileSize)
+			break;
+		uint64_t pos = rng() % (fileSize - assetSize);
+		uint64_t end = pos + assetSize;
+
+		for (size_t length : {4, 4, 8, 16, 4})
+		{
+			pattern.push_back({pos, length});
+			pos += length;
+		}
+
+		while (pos < end)
+		{
+			size_t length = (rng() % 10 == 0) ? 128 * 1024 : 16 + rng() % 2048;
+			length = (size_t)std::min<uint64_t>(length, end - pos);
+			pattern.push_back({pos, length});
+			pos += length;
+		}
+	}
+
+	return pattern;
+}
+
+static void benchPattern(const Options& options, const std::vector<PatternCandidate>& candidates)
+{
+	std::unique_ptr<BLTAbstractDataStore> check(BLTFileDataStore::Open(options.path));
+	std::vector<PatternRead> pattern =
+	    options.patternPath.empty() ? makePattern(check->size()) : loadPattern(options.patternPath, check->size());
+	check.reset();
+
+	size_t largest = 0;
+	uint64_t bytes = 0;
+	for (const PatternRead& read : pattern)
+	{
+		largest = std::max(largest, read.length);
+		bytes += read.length;
+	}
+
+	const char* source = options.patternPath.empty() ? "a made-up pattern" : options.patternPath.c_str();
+	printf("Replaying %zu reads from %s:\n", pattern.size(), source);
+
+	for (const PatternCandidate& candidate : candidates)
+	{
+		size_t reads = 0;
+		std::unique_ptr<BLTAbstractDataStore> ds(candidate.open(options.path, reads));
+
+		std::vector<uint8_t> buffer(largest);
+		uint64_t sum = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (const PatternRead& read : pattern)
+		{
+			ds->read(read.offset, buffer.data(), read.length);
+			sum += buffer[0];
+		}
+		double seconds = secondsSince(start);
+
+		printResult(candidate.name, pattern.size(), bytes, seconds);
+		printf("  %-12s %9zu syscalls\n", "", reads * candidate.syscallsPerRead);
+		if (sum == 0)
+			printf("  (checksum was zero)\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	Options options;
+	options.path = argv[1];
+	size_t createSize = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string opt = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (opt == "--create" && hasValue)
+			createSize = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--small-reads" && hasValue)
+			options.smallReads = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--small-size" && hasValue)
+			options.smallSize = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--large-size" && hasValue)
+			options.largeSize = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--opens" && hasValue)
+			options.opens = strtoull(argv[++i], nullptr, 10);
+		else if (opt == "--pattern" && hasValue)
+			options.patternPath = argv[++i];
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<Candidate> candidates = {
+	    {"file", openFile},
+	    {"shared", openShared},
+	    {"mapped", openMapped},
+	    {"mapped-pool", openMappedPool},
+	};
+
+	std::vector<PatternCandidate> patternCandidates = {
+	    {"file", 2, openCountedFile},
+	    {"shared", 1, openCountedShared},
+	    {"buffered", 1, openCountedBuffered},
+	    {"mapped-pool", 0, openCountedMapped},
+	};
+
+	try
+	{
+		if (createSize)
+			createFile(options.path, createSize);
+
+		// Make sure the file can be opened, and is big enough for the reads
+		std::unique_ptr<BLTAbstractDataStore> check(BLTFileDataStore::Open(options.path));
+		if (!check)
+			PD2HOOK_SIMPLE_THROW_MSG("Failed to open '" + options.path + "'");
+		if (check->size() <= options.smallSize)
+			PD2HOOK_SIMPLE_THROW_MSG("The file must be bigger than the small read size");
+		check.reset();
+
+		benchSmall(options, candidates);
+		benchLarge(options, candidates);
+		benchOpens(options, candidates);
+		benchPattern(options, patternCandidates);
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "Error: %s\n", ex.what());
+		return 1;
+	}
+
+	return 0;
+}